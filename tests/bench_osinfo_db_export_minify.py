@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+#
+# This work is licensed under the GNU GPLv2 or later.
+# See the COPYING file in the top-level directory.
+
+# Compare the same database exported with and without --minify: the
+# size of the archive, the size of the installed files, and how long
+# a consumer takes to load the installed tree, parsing every XML file
+# as libosinfo does when a VM is provisioned. The database to use is
+# taken from $OSINFO_DB_BENCH_DIR, for example a checkout of osinfo-db
+# built with "make", and defaults to the small test database.
+
+import os
+import shutil
+import sys
+import time
+import xml.etree.ElementTree
+import util
+
+RUNS = int(os.environ.get("OSINFO_DB_BENCH_RUNS", "5"))
+
+
+def installed_files(dbdir):
+    for dirpath, _, filenames in os.walk(dbdir):
+        for name in filenames:
+            yield os.path.join(dirpath, name)
+
+
+def load(dbdir):
+    """
+    Parse every XML file of the installed database, the way a
+    consumer loading it would
+    """
+    for path in installed_files(dbdir):
+        if path.endswith(".xml"):
+            xml.etree.ElementTree.parse(path)
+
+
+def bench(source, args):
+    tempdir = util.tempdir()
+    filename = os.path.join(tempdir, "bench.tar.xz")
+    dbdir = os.path.join(tempdir, "db")
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, source]
+    cmd += args + [filename]
+    if util.get_returncode(cmd) != 0:
+        sys.exit("%s: cannot export %s" % (sys.argv[0], source))
+    cmd = [util.Tools.db_import, util.ToolsArgs.DIR, dbdir, filename]
+    if util.get_returncode(cmd) != 0:
+        sys.exit("%s: cannot import %s" % (sys.argv[0], filename))
+
+    size = os.path.getsize(filename)
+    content = sum(os.path.getsize(path) for path in installed_files(dbdir))
+
+    best = None
+    for _ in range(RUNS):
+        start = time.monotonic()
+        load(dbdir)
+        elapsed = time.monotonic() - start
+        if best is None or elapsed < best:
+            best = elapsed
+
+    shutil.rmtree(tempdir)
+    return size, content, best
+
+
+def main():
+    source = os.environ.get("OSINFO_DB_BENCH_DIR", util.Data.positive)
+
+    print("Loading %s, best of %d runs" % (source, RUNS))
+    results = {}
+    for name, args in [("default", []), ("minify", [util.ToolsArgs.MINIFY])]:
+        results[name] = bench(source, args)
+        print("%-8s %10d bytes archive %10d bytes installed %8.3f s load" %
+              ((name,) + results[name]))
+
+    before, after = results["default"], results["minify"]
+    print("--minify saves %.1f%% of the archive, %.1f%% of the installed"
+          " size and %.1f%% of the load time" %
+          (100 - 100.0 * after[0] / before[0],
+           100 - 100.0 * after[1] / before[1],
+           100 - 100.0 * after[2] / before[2]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+#
+# This work is licensed under the GNU GPLv2 or later.
+# See the COPYING file in the top-level directory.
+
+# Compare how fast osinfo-db-import installs the same database from
+# each of the formats osinfo-db-export can write. Every run imports
+# the archive into a new empty directory. The database to use is
+# taken from $OSINFO_DB_BENCH_DIR, for example a checkout of osinfo-db
+# built with "make", and defaults to the small test database.
+
+import os
+import shutil
+import subprocess
+import sys
+import tarfile
+import time
+import util
+
+SUFFIXES = [".tar.xz", ".tar.zst", ".tar.gz", ".tar.bz2", ".tar.lz4"]
+RUNS = int(os.environ.get("OSINFO_DB_BENCH_RUNS", "5"))
+
+
+def content_size(filename):
+    """
+    Total size of the files in the archive, which is what gets
+    written when importing it
+    """
+    with tarfile.open(filename) as archive:
+        return sum(member.size for member in archive if member.isfile())
+
+
+def bench(source, suffix, content):
+    tempdir = util.tempdir()
+    filename = os.path.join(tempdir, "bench" + suffix)
+    dbdir = os.path.join(tempdir, "db")
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, source, filename]
+    if util.get_returncode(cmd) != 0:
+        print("%-8s not supported by libarchive" % suffix)
+        shutil.rmtree(tempdir)
+        return content
+    size = os.path.getsize(filename)
+
+    # Python can only list the members of some of the formats
+    try:
+        content = content_size(filename)
+    except tarfile.TarError:
+        pass
+
+    best = None
+    for _ in range(RUNS):
+        cmd = [util.Tools.db_import, util.ToolsArgs.DIR, dbdir, filename]
+        start = time.monotonic()
+        returncode = subprocess.call(cmd, stdout=subprocess.DEVNULL)
+        elapsed = time.monotonic() - start
+        if returncode != 0:
+            sys.exit("%s: cannot import %s" % (sys.argv[0], filename))
+        shutil.rmtree(dbdir)
+        if best is None or elapsed < best:
+            best = elapsed
+
+    print("%-8s %10d bytes %8.3f s %8.1f MiB/s compressed"
+          " %8.1f MiB/s installed" %
+          (suffix, size, best, size / best / 1024 / 1024,
+           content / best / 1024 / 1024))
+    shutil.rmtree(tempdir)
+    return content
+
+
+def main():
+    source = os.environ.get("OSINFO_DB_BENCH_DIR", util.Data.positive)
+
+    print("Importing %s, best of %d runs" % (source, RUNS))
+    # Every archive holds the same files, whatever the compression
+    content = 0
+    for suffix in SUFFIXES:
+        content = bench(source, suffix, content)
+
+
+if __name__ == "__main__":
+    main()
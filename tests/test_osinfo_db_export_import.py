@@ -4,11 +4,18 @@
 # See the COPYING file in the top-level directory.
 
 import datetime
+import email.utils
 import filecmp
+import glob
+import hashlib
+import io
 import json
 import os
 import shutil
+import subprocess
 import sys
+import tarfile
+import time
 import pytest
 import requests
 import util
@@ -202,6 +209,964 @@ def test_osinfo_db_import_root_user_versioned_file(
     os.unlink(filename)
 
 
+def test_osinfo_db_export_import_minify():
+    """
+    Test osinfo-db-export --minify FILENAME
+    """
+    filename = "minified.tar.xz"
+    xmlfile = os.path.join("os", "fedoraproject.org", "fedora-rawhide.xml")
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           util.ToolsArgs.MINIFY, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    assert os.path.isfile(filename)
+
+    tempdir = util.tempdir()
+    cmd = [util.Tools.db_import, util.ToolsArgs.DIR, tempdir, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+    assert dcmp.left_only == []
+    orig = os.path.join(util.Data.positive, xmlfile)
+    minified = os.path.join(tempdir, xmlfile)
+    assert os.path.getsize(minified) < os.path.getsize(orig)
+    with open(minified) as out:
+        content = out.read()
+        assert "<!--" not in content
+        assert "\n  " not in content
+    shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_osinfo_db_export_validate():
+    """
+    Test osinfo-db-export --validate FILENAME
+    """
+    filename = "validated.tar.xz"
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           util.ToolsArgs.VALIDATE, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    assert os.path.isfile(filename)
+    os.unlink(filename)
+
+
+def test_negative_osinfo_db_export_validate():
+    """
+    Test failure on osinfo-db-export --validate FILENAME
+    """
+    filename = "invalid.tar.xz"
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.negative,
+           util.ToolsArgs.VALIDATE, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 1
+    assert not os.path.exists(filename)
+
+
+def test_osinfo_db_export_multiple_outputs():
+    """
+    Test osinfo-db-export --output FILENAME1 --output FILENAME2 ...
+    """
+    outputs = ["multi.tar.xz", "multi.tar.gz", "multi.tar.bz2"]
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           util.ToolsArgs.VERSION, "multi"]
+    for output in outputs:
+        cmd += [util.ToolsArgs.OUTPUT, output]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    names = None
+    for output in outputs:
+        assert os.path.isfile(output)
+        with tarfile.open(output) as tar:
+            members = sorted(tar.getnames())
+        if names is None:
+            names = members
+        assert members == names
+        os.unlink(output)
+    assert "osinfo-db-multi/VERSION" in names
+
+
+def test_osinfo_db_export_checksum():
+    """
+    Test osinfo-db-export --checksum FILENAME
+    """
+    filename = "checksum.tar.xz"
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           util.ToolsArgs.CHECKSUM, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    assert os.path.isfile(filename)
+    assert glob.glob(".%s.*" % filename) == []
+
+    with open(filename, "rb") as archive:
+        digest = hashlib.sha256(archive.read()).hexdigest()
+    with open(filename + ".sha256") as out:
+        content = out.read()
+        assert content == "%s  %s\n" % (digest, filename)
+    os.unlink(filename)
+    os.unlink(filename + ".sha256")
+
+
+def test_osinfo_db_export_repack():
+    """
+    Test osinfo-db-export --repack ARCHIVE --exclude PATTERN FILENAME
+    """
+    source = "repack-source.tar.xz"
+    filename = "repack.tar.gz"
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           util.ToolsArgs.VERSION, "old", source]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.REPACK, source,
+           util.ToolsArgs.VERSION, "new",
+           util.ToolsArgs.EXCLUDE, "os", filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    with tarfile.open(source) as tar:
+        oldnames = tar.getnames()
+    with tarfile.open(filename) as tar:
+        newnames = tar.getnames()
+        version = tar.extractfile("osinfo-db-new/VERSION").read()
+    assert version == b"new"
+    assert newnames.count("osinfo-db-new/VERSION") == 1
+    assert sorted(newnames) == sorted(
+        [name.replace("osinfo-db-old", "osinfo-db-new") for name in oldnames
+         if not name.startswith("osinfo-db-old/os")])
+    os.unlink(source)
+    os.unlink(filename)
+
+
+@pytest.mark.parametrize("suffix", [".tar.xz", ".tar.zst", ".tar.gz",
+                                    ".tar.bz2", ".tar.lz4"])
+def test_osinfo_db_import_compression(suffix):
+    """
+    Test osinfo-db-import --dir DIR FILENAME with each compression
+    """
+    filename = "compression" + suffix
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    if returncode != 0:
+        pytest.skip("libarchive cannot write %s archives" % suffix)
+
+    # The compression must be detected from the content, not the name
+    renamed = "compression.archive"
+    os.rename(filename, renamed)
+
+    tempdir = util.tempdir()
+    cmd = [util.Tools.db_import, util.ToolsArgs.DIR, tempdir, renamed]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+    assert dcmp.left_only == []
+    assert dcmp.right_only == []
+    assert dcmp.diff_files == []
+    shutil.rmtree(tempdir)
+    os.unlink(renamed)
+
+
+def test_osinfo_db_import_atomic():
+    """
+    Test osinfo-db-import --atomic --dir DIR FILENAME
+    """
+    filename = "atomic.tar.xz"
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    tempdir = util.tempdir()
+    with open(os.path.join(tempdir, "extra.txt"), "w") as out:
+        out.write("extra")
+    cmd = [util.Tools.db_import, util.ToolsArgs.ATOMIC,
+           util.ToolsArgs.DIR, tempdir, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+    assert dcmp.left_only == []
+    assert dcmp.diff_files == []
+    assert "extra.txt" in dcmp.right_only
+    parent, base = os.path.split(tempdir)
+    assert glob.glob(os.path.join(parent, ".%s.*" % base)) == []
+    shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_osinfo_db_import_multiple_dirs():
+    """
+    Test osinfo-db-import --dir DIR1 --dir DIR2 FILENAME
+    """
+    filename = "multiple.tar.xz"
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    tempdirs = [util.tempdir(), util.tempdir()]
+    for args in [[], [util.ToolsArgs.JOBS + "=4"]]:
+        cmd = [util.Tools.db_import] + args
+        for tempdir in tempdirs:
+            cmd += [util.ToolsArgs.DIR, tempdir]
+        returncode = util.get_returncode(cmd + [filename])
+        assert returncode == 0
+
+        for tempdir in tempdirs:
+            dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+            assert dcmp.left_only == []
+            assert dcmp.right_only == []
+            assert dcmp.diff_files == []
+
+    # The same location cannot be given twice
+    cmd = [util.Tools.db_import, util.ToolsArgs.DIR, tempdirs[0],
+           util.ToolsArgs.DIR, tempdirs[0], filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode != 0
+
+    # Nor one inside another, which --prune would wipe out
+    nested = os.path.join(tempdirs[0], "os")
+    cmd = [util.Tools.db_import, util.ToolsArgs.DIR, tempdirs[0],
+           util.ToolsArgs.DIR, nested, util.ToolsArgs.PRUNE, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode != 0
+    assert os.path.isdir(nested)
+
+    for tempdir in tempdirs:
+        shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_osinfo_db_import_content_store():
+    """
+    Test osinfo-db-import --content-store PATH --dir DIR1 --dir DIR2 FILENAME
+    """
+    filename = "content.tar.xz"
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    tempdir = util.tempdir()
+    store = os.path.join(tempdir, "store")
+    dirs = [os.path.join(tempdir, "a"), os.path.join(tempdir, "b")]
+    cmd = [util.Tools.db_import, util.ToolsArgs.CONTENT_STORE, store,
+           util.ToolsArgs.DIR, dirs[0], util.ToolsArgs.DIR, dirs[1],
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    for d in dirs:
+        dcmp = filecmp.dircmp(util.Data.positive, d)
+        assert dcmp.left_only == []
+        assert dcmp.diff_files == []
+    for root, _, files in os.walk(dirs[0]):
+        for name in files:
+            path = os.path.join(root, name)
+            other = os.path.join(dirs[1], os.path.relpath(path, dirs[0]))
+            assert os.path.samefile(path, other)
+            with open(path, "rb") as f:
+                digest = hashlib.sha256(f.read()).hexdigest()
+            assert os.path.samefile(
+                path, os.path.join(store, digest[:2], digest[2:]))
+
+    # Importing again over the same links leaves nothing behind
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    for root, _, files in os.walk(dirs[0]):
+        assert [name for name in files if name.startswith(".")] == []
+
+    # Reflinks fall back to copies where they are not supported
+    shutil.rmtree(dirs[1])
+    cmd = [util.Tools.db_import, util.ToolsArgs.CONTENT_STORE, store,
+           util.ToolsArgs.REFLINK, util.ToolsArgs.DIR, dirs[1], filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    dcmp = filecmp.dircmp(util.Data.positive, dirs[1])
+    assert dcmp.left_only == []
+    assert dcmp.diff_files == []
+
+    cmd = [util.Tools.db_import, util.ToolsArgs.REFLINK,
+           util.ToolsArgs.DIR, dirs[1], filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode != 0
+
+    shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_osinfo_db_import_snapshots():
+    """
+    Test osinfo-db-import --keep-snapshots N and --rollback[=VERSION]
+    """
+    versions = ["20230101", "20240101", "20250101"]
+
+    tempdir = util.tempdir()
+    dbdir = os.path.join(tempdir, "db")
+    snapdir = os.path.join(tempdir, ".db.snapshots")
+
+    def installed():
+        with open(os.path.join(dbdir, "VERSION")) as out:
+            return out.read()
+
+    for version in versions:
+        filename = "snapshot-%s.tar.xz" % version
+        cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+               util.ToolsArgs.VERSION, version, filename]
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+
+        cmd = [util.Tools.db_import, util.ToolsArgs.KEEP_SNAPSHOTS + "=2",
+               util.ToolsArgs.DIR, dbdir, filename]
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        assert installed() == version
+        os.unlink(filename)
+
+    assert sorted(os.listdir(snapdir)) == versions[1:]
+
+    cmd = [util.Tools.db_import, util.ToolsArgs.ROLLBACK,
+           util.ToolsArgs.DIR, dbdir]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    assert installed() == versions[1]
+    dcmp = filecmp.dircmp(util.Data.positive, dbdir)
+    assert dcmp.left_only == []
+    assert dcmp.diff_files == []
+
+    cmd = [util.Tools.db_import, util.ToolsArgs.ROLLBACK + "=" + versions[2],
+           util.ToolsArgs.DIR, dbdir]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    assert installed() == versions[2]
+
+    cmd = [util.Tools.db_import, util.ToolsArgs.ROLLBACK + "=" + versions[0],
+           util.ToolsArgs.DIR, dbdir]
+    returncode = util.get_returncode(cmd)
+    assert returncode != 0
+    assert installed() == versions[2]
+
+    parent, base = os.path.split(dbdir)
+    assert glob.glob(os.path.join(parent, ".%s.??????" % base)) == []
+    shutil.rmtree(tempdir)
+
+
+def test_osinfo_db_import_layered():
+    """
+    Test osinfo-db-import --dir DIR VENDOR SITE OVERRIDES
+    """
+    vendor = "vendor.tar.xz"
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           vendor]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    fedora = "os/fedoraproject.org/fedora-rawhide.xml"
+    qemu = "platform/linux-kvm.org/qemu-kvm-1.2.0.xml"
+    layers = {
+        "site.tar": {fedora: b"<libosinfo/>\n", "os/extra.xml": b"site"},
+        "overrides.tar.gz": {qemu: b"", "os/extra.xml": b"overrides"},
+    }
+    for filename, files in layers.items():
+        mode = "w:gz" if filename.endswith(".gz") else "w"
+        with tarfile.open(filename, mode) as tar:
+            for name, content in files.items():
+                info = tarfile.TarInfo("layer/" + name)
+                info.size = len(content)
+                tar.addfile(info, io.BytesIO(content))
+
+    tempdir = util.tempdir()
+    cmd = [util.Tools.db_import, util.ToolsArgs.DIR, tempdir, vendor,
+           "site.tar", "overrides.tar.gz"]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    def content(name):
+        with open(os.path.join(tempdir, name), "rb") as f:
+            return f.read()
+
+    assert content(fedora) == b"<libosinfo/>\n"
+    assert content("os/extra.xml") == b"overrides"
+    # A zero-length file blacks out the one from lower layers
+    assert content(qemu) == b""
+    assert filecmp.cmp(os.path.join(tempdir, "schema/osinfo.rng"),
+                       os.path.join(util.Data.positive, "schema/osinfo.rng"))
+
+    shutil.rmtree(tempdir)
+    os.unlink(vendor)
+    for filename in layers:
+        os.unlink(filename)
+
+
+def test_osinfo_db_import_validate():
+    """
+    Test osinfo-db-import --validate --dir DIR FILENAME
+    """
+    filename = "valid.tar.xz"
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    tempdir = util.tempdir()
+    cmd = [util.Tools.db_import, util.ToolsArgs.VALIDATE,
+           util.ToolsArgs.DIR, tempdir, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+    assert dcmp.left_only == []
+    assert dcmp.diff_files == []
+    shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_negative_osinfo_db_import_validate():
+    """
+    Test failure on osinfo-db-import --validate --dir DIR FILENAME
+    """
+    filename = "invalid.tar.xz"
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.negative,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    # Nothing must reach the target directory
+    tempdir = util.tempdir()
+    with open(os.path.join(tempdir, "extra.txt"), "w") as out:
+        out.write("extra")
+    cmd = [util.Tools.db_import, util.ToolsArgs.VALIDATE,
+           util.ToolsArgs.DIR, tempdir, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 1
+    assert os.listdir(tempdir) == ["extra.txt"]
+    parent, base = os.path.split(tempdir)
+    assert glob.glob(os.path.join(parent, ".%s.*" % base)) == []
+    shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_osinfo_db_import_skip_unchanged():
+    """
+    Test osinfo-db-import --skip-unchanged --dir DIR FILENAME
+    """
+    filename = "unchanged.tar.xz"
+    changed = os.path.join("os", "fedoraproject.org", "fedora-rawhide.xml")
+    removed = os.path.join("datamap", "x.org", "x11-keyboard.xml")
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    tempdir = util.tempdir()
+    cmd = [util.Tools.db_import, util.ToolsArgs.DIR, tempdir, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    total = sum(len(files) for _, _, files in os.walk(tempdir))
+
+    with open(os.path.join(tempdir, changed), "a") as out:
+        out.write("\n")
+    os.unlink(os.path.join(tempdir, removed))
+
+    cmd = [util.Tools.db_import, util.ToolsArgs.SKIP_UNCHANGED,
+           util.ToolsArgs.DIR, tempdir, filename]
+    output = util.get_output(cmd)
+    assert "1 files written, %d unchanged, 1 new" % (total - 2) in output
+    dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+    assert dcmp.left_only == []
+    assert filecmp.cmp(os.path.join(util.Data.positive, changed),
+                       os.path.join(tempdir, changed), shallow=False)
+    shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_osinfo_db_import_prune():
+    """
+    Test osinfo-db-import --prune --dir DIR FILENAME
+    """
+    filename = "prune.tar.xz"
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    tempdir = util.tempdir()
+    stale = os.path.join(tempdir, "os", "example.org")
+    os.makedirs(stale)
+    with open(os.path.join(stale, "stale.xml"), "w") as out:
+        out.write("<libosinfo/>")
+    cmd = [util.Tools.db_import, util.ToolsArgs.PRUNE,
+           util.ToolsArgs.DIR, tempdir, filename]
+    output = util.get_output(cmd)
+    assert "removed os/example.org/stale.xml" in output
+    assert "removed os/example.org\n" in output
+    assert not os.path.exists(stale)
+    dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+    assert dcmp.left_only == []
+    assert dcmp.right_only == ["VERSION"]
+    shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_osinfo_db_import_sync():
+    """
+    Test osinfo-db-import --sync MODE --dir DIR FILENAME
+    """
+    filename = "sync.tar.xz"
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    for mode in ["none", "batch", "full"]:
+        tempdir = util.tempdir()
+        cmd = [util.Tools.db_import, "%s=%s" % (util.ToolsArgs.SYNC, mode),
+               util.ToolsArgs.DIR, tempdir, filename]
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+        assert dcmp.left_only == []
+        shutil.rmtree(tempdir)
+
+    tempdir = util.tempdir()
+    cmd = [util.Tools.db_import, "%s=sometimes" % util.ToolsArgs.SYNC,
+           util.ToolsArgs.DIR, tempdir, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 1
+    assert os.listdir(tempdir) == []
+    shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_osinfo_db_import_jobs():
+    """
+    Test osinfo-db-import --jobs N --dir DIR FILENAME
+    """
+    filename = "jobs.tar.xz"
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    tempdir = util.tempdir()
+    cmd = [util.Tools.db_import, util.ToolsArgs.JOBS, "4",
+           util.ToolsArgs.DIR, tempdir, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    for root, _, files in os.walk(util.Data.positive):
+        relroot = os.path.relpath(root, util.Data.positive)
+        for name in files:
+            assert filecmp.cmp(os.path.join(root, name),
+                               os.path.join(tempdir, relroot, name),
+                               shallow=False)
+    shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_osinfo_db_import_throttle():
+    """
+    Test osinfo-db-import --nice --max-write-rate BYTES --dir DIR FILENAME
+    """
+    filename = "throttle.tar.xz"
+    rate = 32 * 1024
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    # Every file counts for at least one block
+    total = 0
+    for root, _, files in os.walk(util.Data.positive):
+        for name in files:
+            total += max(os.path.getsize(os.path.join(root, name)), 4096)
+
+    tempdir = util.tempdir()
+    cmd = [util.Tools.db_import, util.ToolsArgs.NICE,
+           util.ToolsArgs.MAX_WRITE_RATE, str(rate),
+           util.ToolsArgs.DIR, tempdir, filename]
+    if sys.platform.startswith("linux"):
+        cmd[1:1] = [util.ToolsArgs.IO_PRIORITY, "idle"]
+    start = time.monotonic()
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    # The first second worth of writes goes through straight away
+    assert time.monotonic() - start >= (total - rate) / rate
+    dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+    assert dcmp.left_only == []
+    assert dcmp.diff_files == []
+    shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_osinfo_db_import_checksum():
+    """
+    Test osinfo-db-import --checksum SHA256 --dir DIR FILENAME
+    """
+    filename = "checksum.tar.xz"
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    with open(filename, "rb") as archive:
+        digest = hashlib.sha256(archive.read()).hexdigest()
+
+    # A mismatch must leave the target directory untouched
+    tempdir = util.tempdir()
+    with open(os.path.join(tempdir, "extra.txt"), "w") as out:
+        out.write("extra")
+    cmd = [util.Tools.db_import, util.ToolsArgs.CHECKSUM + "=" + "0" * 64,
+           util.ToolsArgs.DIR, tempdir, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode != 0
+    assert os.listdir(tempdir) == ["extra.txt"]
+
+    cmd = [util.Tools.db_import, util.ToolsArgs.CHECKSUM + "=" + "xyz",
+           util.ToolsArgs.DIR, tempdir, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode != 0
+
+    cmd = [util.Tools.db_import, util.ToolsArgs.CHECKSUM + "=" + digest,
+           util.ToolsArgs.DIR, tempdir, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+    assert dcmp.left_only == []
+    assert dcmp.diff_files == []
+    shutil.rmtree(tempdir)
+    os.unlink(filename)
+
+
+def test_osinfo_db_import_latest_conditional(monkeypatch):
+    """
+    Test osinfo-db-import --latest --check-only --metadata-url URL
+    """
+    version = "20990101"
+    srvdir = util.tempdir()
+    cachedir = util.tempdir()
+    tempdir = util.tempdir()
+    filename = os.path.join(srvdir, "osinfo-db-%s.tar.xz" % version)
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           util.ToolsArgs.VERSION, version, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    monkeypatch.setenv("XDG_CACHE_HOME", cachedir)
+    with util.HTTPServer(srvdir) as server:
+        with open(os.path.join(srvdir, "latest.json"), "w") as out:
+            json.dump({"release": {
+                "version": version,
+                "archive": "%s/%s" % (server.url,
+                                      os.path.basename(filename))}}, out)
+        args = [util.ToolsArgs.LATEST,
+                util.ToolsArgs.METADATA_URL, server.url + "/latest.json",
+                util.ToolsArgs.DIR, tempdir]
+
+        cmd = [util.Tools.db_import, util.ToolsArgs.CHECK_ONLY] + args
+        returncode = util.get_returncode(cmd)
+        assert returncode == 100
+        assert os.listdir(tempdir) == []
+
+        cmd = [util.Tools.db_import] + args
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        with open(os.path.join(tempdir, "VERSION")) as out:
+            assert out.read() == version
+
+        del server.statuses[:]
+        cmd = [util.Tools.db_import, util.ToolsArgs.CHECK_ONLY] + args
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        assert server.statuses == [304]
+
+    shutil.rmtree(srvdir)
+    shutil.rmtree(cachedir)
+    shutil.rmtree(tempdir)
+
+
+def test_osinfo_db_import_latest_rollback(monkeypatch):
+    """
+    Test osinfo-db-import --latest after --rollback
+    """
+    versions = ["20980101", "20990101"]
+    srvdir = util.tempdir()
+    cachedir = util.tempdir()
+    tempdir = util.tempdir()
+    dbdir = os.path.join(tempdir, "db")
+
+    def installed():
+        with open(os.path.join(dbdir, "VERSION")) as out:
+            return out.read()
+
+    for version in versions:
+        filename = os.path.join(srvdir, "osinfo-db-%s.tar.xz" % version)
+        cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+               util.ToolsArgs.VERSION, version, filename]
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+
+    cmd = [util.Tools.db_import, util.ToolsArgs.KEEP_SNAPSHOTS + "=2",
+           util.ToolsArgs.DIR, dbdir,
+           os.path.join(srvdir, "osinfo-db-%s.tar.xz" % versions[0])]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    monkeypatch.setenv("XDG_CACHE_HOME", cachedir)
+    with util.HTTPServer(srvdir) as server:
+        with open(os.path.join(srvdir, "latest.json"), "w") as out:
+            json.dump({"release": {
+                "version": versions[1],
+                "archive": "%s/osinfo-db-%s.tar.xz" % (server.url,
+                                                       versions[1])}}, out)
+        args = [util.ToolsArgs.LATEST, util.ToolsArgs.KEEP_SNAPSHOTS + "=2",
+                util.ToolsArgs.METADATA_URL, server.url + "/latest.json",
+                util.ToolsArgs.DIR, dbdir]
+
+        cmd = [util.Tools.db_import] + args
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        assert installed() == versions[1]
+
+        cmd = [util.Tools.db_import, util.ToolsArgs.ROLLBACK,
+               util.ToolsArgs.DIR, dbdir]
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        assert installed() == versions[0]
+
+        # The validators belong to the version rolled back from
+        del server.statuses[:]
+        cmd = [util.Tools.db_import, util.ToolsArgs.CHECK_ONLY] + args
+        returncode = util.get_returncode(cmd)
+        assert returncode == 100
+        assert server.statuses[0] == 200
+
+        cmd = [util.Tools.db_import] + args
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        assert installed() == versions[1]
+
+    shutil.rmtree(srvdir)
+    shutil.rmtree(cachedir)
+    shutil.rmtree(tempdir)
+
+
+def test_osinfo_db_import_serve(monkeypatch):
+    """
+    Test osinfo-db-import --latest --serve PORT
+    """
+    version = "20990101"
+    srvdir = util.tempdir()
+    cachedir = util.tempdir()
+    filename = os.path.join(srvdir, "osinfo-db-%s.tar.xz" % version)
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           util.ToolsArgs.VERSION, version, filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+
+    monkeypatch.setenv("XDG_CACHE_HOME", cachedir)
+    with util.HTTPServer(srvdir) as server:
+        with open(os.path.join(srvdir, "latest.json"), "w") as out:
+            json.dump({"release": {
+                "version": version,
+                "archive": "%s/%s" % (server.url,
+                                      os.path.basename(filename))}}, out)
+
+        # Port 0 lets the system pick one, which is then printed
+        cmd = [util.Tools.db_import, util.ToolsArgs.SERVE, "0",
+               util.ToolsArgs.LATEST,
+               util.ToolsArgs.METADATA_URL, server.url + "/latest.json"]
+        mirror = subprocess.Popen(cmd, stdout=subprocess.PIPE)
+        try:
+            port = int(mirror.stdout.readline().split()[-1])
+            url = "http://127.0.0.1:%d/latest.json" % port
+            assert server.statuses == [200, 200]
+
+            release = requests.get(url).json()["release"]
+            assert release["version"] == version
+            assert release["archive"].startswith("http://127.0.0.1:%d/" % port)
+
+            # Every host is served from the mirror, not from upstream
+            for _ in range(2):
+                tempdir = util.tempdir()
+                cmd = [util.Tools.db_import, util.ToolsArgs.LATEST,
+                       util.ToolsArgs.METADATA_URL, url,
+                       util.ToolsArgs.CACHE_SIZE, "0",
+                       util.ToolsArgs.DIR, tempdir]
+                returncode = util.get_returncode(cmd)
+                assert returncode == 0
+                with open(os.path.join(tempdir, "VERSION")) as out:
+                    assert out.read() == version
+                dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+                assert dcmp.left_only == []
+                assert dcmp.diff_files == []
+                shutil.rmtree(tempdir)
+            assert server.statuses == [200, 200]
+        finally:
+            mirror.terminate()
+            mirror.wait()
+
+    shutil.rmtree(srvdir)
+    shutil.rmtree(cachedir)
+
+
+def test_osinfo_db_import_url_resume(monkeypatch):
+    """
+    Test osinfo-db-import URL resuming a partial download
+    """
+    srvdir = util.tempdir()
+    cachedir = util.tempdir()
+    tempdir = util.tempdir()
+    filename = os.path.join(srvdir, "resume.tar.xz")
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    with open(filename, "rb") as archive:
+        content = archive.read()
+    lastmod = email.utils.formatdate(os.stat(filename).st_mtime, usegmt=True)
+
+    monkeypatch.setenv("XDG_CACHE_HOME", cachedir)
+    with util.HTTPServer(srvdir) as server:
+        url = server.url + "/resume.tar.xz"
+        digest = hashlib.sha256(url.encode()).hexdigest()
+        partial = os.path.join(cachedir, "osinfo-db-tools", digest)
+        os.makedirs(os.path.dirname(partial))
+        with open(partial + ".part", "wb") as out:
+            out.write(content[:len(content) // 2])
+        with open(partial + ".partial", "w") as out:
+            out.write("[download]\nurl=%s\nvalidator=%s\n" % (url, lastmod))
+
+        cmd = [util.Tools.db_import, util.ToolsArgs.DIR, tempdir, url]
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        assert server.statuses == [206]
+
+    dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+    assert dcmp.left_only == []
+    assert dcmp.diff_files == []
+    assert not os.path.exists(partial + ".part")
+    assert not os.path.exists(partial + ".partial")
+    shutil.rmtree(srvdir)
+    shutil.rmtree(cachedir)
+    shutil.rmtree(tempdir)
+
+
+def test_osinfo_db_import_url_cache(monkeypatch):
+    """
+    Test osinfo-db-import URL reusing a cached download
+    """
+    srvdir = util.tempdir()
+    cachedir = util.tempdir()
+    shareddir = util.tempdir()
+    filename = os.path.join(srvdir, "cached.tar.xz")
+
+    cmd = [util.Tools.db_export, util.ToolsArgs.DIR, util.Data.positive,
+           filename]
+    returncode = util.get_returncode(cmd)
+    assert returncode == 0
+    with open(filename, "rb") as archive:
+        digest = hashlib.sha256(archive.read()).hexdigest()
+
+    monkeypatch.setenv("XDG_CACHE_HOME", cachedir)
+    with util.HTTPServer(srvdir) as server:
+        url = server.url + "/cached.tar.xz"
+        cached = os.path.join(cachedir, "osinfo-db-tools", "archives", digest)
+
+        # Downloaded once, then only revalidated
+        for statuses in [[200], [200, 304]]:
+            tempdir = util.tempdir()
+            cmd = [util.Tools.db_import, util.ToolsArgs.DIR, tempdir, url]
+            returncode = util.get_returncode(cmd)
+            assert returncode == 0
+            assert server.statuses == statuses
+            assert os.path.isfile(cached)
+            dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+            assert dcmp.left_only == []
+            assert dcmp.diff_files == []
+            shutil.rmtree(tempdir)
+
+        # No need to ask the server at all with a known digest
+        tempdir = util.tempdir()
+        cmd = [util.Tools.db_import, util.ToolsArgs.CHECKSUM, digest,
+               util.ToolsArgs.DIR, tempdir, url]
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        assert server.statuses == [200, 304]
+        shutil.rmtree(tempdir)
+
+        tempdir = util.tempdir()
+        cmd = [util.Tools.db_import, util.ToolsArgs.SHARED_CACHE, shareddir,
+               util.ToolsArgs.DIR, tempdir, url]
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        assert server.statuses == [200, 304, 200]
+        shared = os.path.join(shareddir, digest)
+        assert os.path.isfile(shared)
+        assert os.stat(shared).st_mode & 0o777 == 0o444
+        shutil.rmtree(tempdir)
+
+        # A tampered archive is dropped from the cache, not imported
+        os.chmod(shared, 0o644)
+        with open(shared, "wb") as archive:
+            archive.write(b"tampered")
+        tempdir = util.tempdir()
+        cmd = [util.Tools.db_import, util.ToolsArgs.SHARED_CACHE, shareddir,
+               util.ToolsArgs.CHECKSUM, digest,
+               util.ToolsArgs.DIR, tempdir, url]
+        returncode = util.get_returncode(cmd)
+        assert returncode != 0
+        assert server.statuses == [200, 304, 200]
+        assert not os.path.exists(shared)
+        assert os.listdir(tempdir) == []
+
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        assert server.statuses == [200, 304, 200, 200]
+        with open(shared, "rb") as archive:
+            assert hashlib.sha256(archive.read()).hexdigest() == digest
+        dcmp = filecmp.dircmp(util.Data.positive, tempdir)
+        assert dcmp.diff_files == []
+        shutil.rmtree(tempdir)
+
+        # Nothing is kept when the cache has no room for it
+        tempdir = util.tempdir()
+        shutil.rmtree(shareddir)
+        cmd = [util.Tools.db_import, util.ToolsArgs.SHARED_CACHE, shareddir,
+               util.ToolsArgs.CACHE_SIZE, "1024",
+               util.ToolsArgs.DIR, tempdir, url]
+        returncode = util.get_returncode(cmd)
+        assert returncode == 0
+        assert server.statuses == [200, 304, 200, 200, 200]
+        assert os.listdir(shareddir) == [
+            hashlib.sha256(url.encode()).hexdigest() + ".lock"]
+        shutil.rmtree(tempdir)
+
+    shutil.rmtree(srvdir)
+    shutil.rmtree(cachedir)
+    shutil.rmtree(shareddir)
+
+
 @pytest.mark.skipif(os.environ.get("OSINFO_DB_TOOLS_NETWORK_TESTS") is None,
                     reason="Network related tests are not enabled")
 def test_osinfo_db_import_url():
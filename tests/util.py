@@ -2,9 +2,12 @@
 # See the COPYING file in the top-level directory
 
 from enum import EnumMeta
+import functools
+import http.server
 import os
 import subprocess
 import tempfile
+import threading
 
 
 class _Tools():
@@ -110,6 +113,82 @@ def tempdir():
     return tmpdir
 
 
+class _HTTPRequestHandler(http.server.SimpleHTTPRequestHandler):
+    """
+    Request handler recording the status code of each response
+    """
+    def log_request(self, code="-", size="-"):
+        self.server.statuses.append(int(code))
+
+    def send_head(self):
+        """
+        Add support for a single "Range: bytes=N-" header, validated
+        against Last-Modified when sent along with If-Range
+        """
+        path = self.translate_path(self.path)
+        ranges = self.headers.get("Range")
+        if ranges is None or not os.path.isfile(path):
+            return super().send_head()
+
+        stat = os.stat(path)
+        lastmod = self.date_time_string(stat.st_mtime)
+        ifrange = self.headers.get("If-Range")
+        if ifrange is not None and ifrange != lastmod:
+            return super().send_head()
+
+        start = int(ranges.split("=")[1].split("-")[0])
+        if start >= stat.st_size:
+            self.send_error(416)
+            return None
+
+        data = open(path, "rb")
+        data.seek(start)
+        self.send_response(206)
+        self.send_header("Content-Type", self.guess_type(path))
+        self.send_header("Content-Range", "bytes %d-%d/%d" %
+                         (start, stat.st_size - 1, stat.st_size))
+        self.send_header("Content-Length", str(stat.st_size - start))
+        self.send_header("Last-Modified", lastmod)
+        self.end_headers()
+        return data
+
+
+class HTTPServer():
+    """
+    Serve a directory over HTTP on localhost, to stand in for
+    db.libosinfo.org during the tests
+    """
+    def __init__(self, directory):
+        handler = functools.partial(_HTTPRequestHandler, directory=directory)
+        self.server = http.server.ThreadingHTTPServer(("127.0.0.1", 0),
+                                                      handler)
+        self.server.statuses = []
+        self.thread = threading.Thread(target=self.server.serve_forever)
+
+    @property
+    def url(self):
+        """
+        Get the base URL of the server
+        """
+        return "http://127.0.0.1:%d" % self.server.server_address[1]
+
+    @property
+    def statuses(self):
+        """
+        Get the status codes of the responses sent so far
+        """
+        return self.server.statuses
+
+    def __enter__(self):
+        self.thread.start()
+        return self
+
+    def __exit__(self, *args):
+        self.server.shutdown()
+        self.server.server_close()
+        self.thread.join()
+
+
 def get_output(cmd):
     """
     Get the stdout output from a command execution
@@ -142,6 +221,37 @@ class ToolsArgs(EnumMeta):
     # --license is only valid for osinfo-db-export
     LICENSE = "--license"
     VERSION = "--version"
+    MINIFY = "--minify"
+    # --validate is valid for both osinfo-db-export and osinfo-db-import
+    VALIDATE = "--validate"
+    # --output, --repack, --include & --exclude are only valid for
+    # osinfo-db-export, --checksum takes a digest with osinfo-db-import
+    OUTPUT = "--output"
+    CHECKSUM = "--checksum"
+    REPACK = "--repack"
+    INCLUDE = "--include"
+    EXCLUDE = "--exclude"
     # --latest && --nightly are only valid for osinfo-db-import
     LATEST = "--latest"
     NIGHTLY = "--nightly"
+    # --atomic, --skip-unchanged, --prune, --sync, --jobs, --check-only,
+    # --metadata-url, --content-store, --reflink, --keep-snapshots,
+    # --rollback, --cache-size, --shared-cache, --serve, --io-priority,
+    # --max-write-rate & --nice are only valid for osinfo-db-import
+    ATOMIC = "--atomic"
+    SKIP_UNCHANGED = "--skip-unchanged"
+    PRUNE = "--prune"
+    SYNC = "--sync"
+    JOBS = "--jobs"
+    CHECK_ONLY = "--check-only"
+    METADATA_URL = "--metadata-url"
+    CONTENT_STORE = "--content-store"
+    REFLINK = "--reflink"
+    KEEP_SNAPSHOTS = "--keep-snapshots"
+    ROLLBACK = "--rollback"
+    CACHE_SIZE = "--cache-size"
+    SHARED_CACHE = "--shared-cache"
+    SERVE = "--serve"
+    IO_PRIORITY = "--io-priority"
+    MAX_WRITE_RATE = "--max-write-rate"
+    NICE = "--nice"
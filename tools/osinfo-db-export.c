@@ -23,76 +23,690 @@
 #include <locale.h>
 #include <glib/gi18n.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <archive.h>
 #include <archive_entry.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <glib/gstdio.h>
 
 #include "osinfo-db-util.h"
+#include "osinfo-db-xml.h"
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
 
 const char *argv0;
 
 time_t entryts;
 
-static int osinfo_db_export_create_file(const gchar *prefix,
+/* Byte counts before / after --minify, for the verbose summary */
+gsize minify_insize;
+gsize minify_outsize;
+
+/* Entries which may be pending for each archive writer thread */
+#define OSINFO_DB_EXPORT_QUEUE_MAX 64
+
+/* Largest file accepted from a --repack source archive */
+#define OSINFO_DB_EXPORT_ENTRY_MAX (64 * 1024 * 1024)
+#define OSINFO_DB_EXPORT_READSIZE (64 * 1024)
+
+typedef struct _OsinfoDbExportJob OsinfoDbExportJob;
+struct _OsinfoDbExportJob {
+    struct archive_entry *entry;
+    GBytes *data;
+};
+
+/*
+ * Each output archive is written, and so compressed, by its own
+ * thread. The directory walk reads every file once and hands the
+ * resulting entries to all writers through a bounded queue.
+ *
+ * Archive files, and their checksum files, are written to a
+ * temporary file alongside the target, which is only renamed into
+ * place once every archive has been written out and synced
+ * successfully.
+ */
+typedef struct _OsinfoDbExportWriter OsinfoDbExportWriter;
+struct _OsinfoDbExportWriter {
+    gchar *target;
+    gchar *tmppath;
+    gchar *sumtmppath;
+    int fd;
+    GChecksum *checksum;
+    struct archive *arc;
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    GQueue jobs;
+    gboolean finished;
+    gboolean failed;
+};
+
+typedef struct _OsinfoDbExport OsinfoDbExport;
+struct _OsinfoDbExport {
+    const gchar *prefix;
+    GFile *base;
+    GPtrArray *writers;
+    gboolean minify;
+    OsinfoDbSchema *rng;
+    gchar **includes;
+    gchar **excludes;
+    gboolean verbose;
+};
+
+static const struct {
+    const gchar *suffix;
+    const gchar *filter;
+} osinfo_db_export_filters[] = {
+    { ".tar.xz", "xz" },
+    { ".tar.zst", "zstd" },
+    { ".tar.gz", "gzip" },
+    { ".tgz", "gzip" },
+    { ".tar.bz2", "bzip2" },
+    { ".tar.lz4", "lz4" },
+};
+
+static int osinfo_db_export_create_file(OsinfoDbExport *export,
                                         GFile *file,
-                                        GFileInfo *info,
-                                        GFile *base,
-                                        const gchar *target,
-                                        struct archive *arc,
-                                        gboolean verbose);
+                                        GFileInfo *info);
 
 
-static int osinfo_db_export_create_reg(GFile *file,
-                                       const gchar *abspath,
-                                       const gchar *target,
-                                       struct archive *arc)
+static void osinfo_db_export_strip_comments(xmlNodePtr node)
 {
-    g_autoptr(GFileInputStream) is = NULL;
-    g_autoptr(GError) err = NULL;
-    g_autofree gchar *buf = NULL;
+    xmlNodePtr child = node->children;
+
+    while (child) {
+        xmlNodePtr next = child->next;
+
+        if (child->type == XML_COMMENT_NODE) {
+            xmlUnlinkNode(child);
+            xmlFreeNode(child);
+        } else {
+            osinfo_db_export_strip_comments(child);
+        }
+        child = next;
+    }
+}
+
+/*
+ * Check an XML document against the schema and/or minify it
+ * before it is archived. Minifying drops comments and the
+ * insignificant whitespace used for pretty printing. Either
+ * way the whole document is held in memory, since the entry
+ * size has to be known before the archive header is written.
+ */
+static GBytes *osinfo_db_export_process_xml(OsinfoDbExport *export,
+                                            const gchar *name,
+                                            GBytes *data)
+{
+    GBytes *ret = NULL;
+    gconstpointer buf;
+    gsize length;
+    xmlDocPtr doc = NULL;
+    xmlChar *out = NULL;
+    int outlen = 0;
+
+    buf = g_bytes_get_data(data, &length);
+    doc = xmlReadMemory(buf, length, name, NULL,
+                        XML_PARSE_NONET |
+                        XML_PARSE_NOWARNING |
+                        (export->minify ? XML_PARSE_NOBLANKS : 0));
+    if (!doc) {
+        g_printerr("%s: cannot parse XML document %s\n",
+                   argv0, name);
+        goto cleanup;
+    }
+
+    if (export->rng && !osinfo_db_schema_validate_doc(export->rng, doc, name, NULL)) {
+        g_printerr("%s: XML document %s does not validate against the schema\n",
+                   argv0, name);
+        goto cleanup;
+    }
+
+    if (export->minify) {
+        osinfo_db_export_strip_comments((xmlNodePtr)doc);
+        xmlDocDumpMemoryEnc(doc, &out, &outlen, "UTF-8");
+        if (!out) {
+            g_printerr("%s: cannot serialize XML document %s\n",
+                       argv0, name);
+            goto cleanup;
+        }
+
+        minify_insize += length;
+        minify_outsize += outlen;
+
+        ret = g_bytes_new(out, outlen);
+    } else {
+        ret = g_bytes_ref(data);
+    }
+
+ cleanup:
+    xmlFree(out);
+    xmlFreeDoc(doc);
+    return ret;
+}
+
+
+static void osinfo_db_export_job_free(OsinfoDbExportJob *job)
+{
+    archive_entry_free(job->entry);
+    if (job->data)
+        g_bytes_unref(job->data);
+    g_free(job);
+}
+
+
+static OsinfoDbExportWriter *osinfo_db_export_writer_new(const gchar *target)
+{
+    OsinfoDbExportWriter *writer = g_new0(OsinfoDbExportWriter, 1);
+
+    writer->target = g_strdup(target);
+    writer->fd = -1;
+    writer->arc = archive_write_new();
+    g_mutex_init(&writer->lock);
+    g_cond_init(&writer->cond);
+    g_queue_init(&writer->jobs);
+
+    return writer;
+}
+
+
+static void osinfo_db_export_writer_free(OsinfoDbExportWriter *writer)
+{
+    archive_write_free(writer->arc);
+    /* Never committed, so discard the incomplete archive */
+    if (writer->tmppath) {
+        if (writer->fd >= 0)
+            close(writer->fd);
+        g_unlink(writer->tmppath);
+        g_free(writer->tmppath);
+    }
+    if (writer->sumtmppath) {
+        g_unlink(writer->sumtmppath);
+        g_free(writer->sumtmppath);
+    }
+    if (writer->checksum)
+        g_checksum_free(writer->checksum);
+    g_mutex_clear(&writer->lock);
+    g_cond_clear(&writer->cond);
+    g_free(writer->target);
+    g_free(writer);
+}
+
+
+static la_ssize_t osinfo_db_export_writer_output(struct archive *arc,
+                                                 void *opaque,
+                                                 const void *buf,
+                                                 size_t len)
+{
+    OsinfoDbExportWriter *writer = opaque;
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t rv = write(writer->fd, (const char *)buf + done, len - done);
+        if (rv < 0) {
+            if (errno == EINTR)
+                continue;
+            archive_set_error(arc, errno, "%s", g_strerror(errno));
+            return -1;
+        }
+        done += rv;
+    }
+
+    if (writer->checksum)
+        g_checksum_update(writer->checksum, buf, len);
+
+    return len;
+}
+
+
+static int osinfo_db_export_writer_write(OsinfoDbExportWriter *writer,
+                                         OsinfoDbExportJob *job)
+{
+    gconstpointer data;
     gsize size;
-    gsize rv;
 
-    is = g_file_read(file, NULL, &err);
-    if (!is) {
-        g_printerr("%s: cannot read file %s: %s\n",
-                   argv0, abspath, err->message);
+    if (archive_write_header(writer->arc, job->entry) != ARCHIVE_OK) {
+        g_printerr("%s: cannot write archive header %s: %s\n",
+                   argv0, writer->target, archive_error_string(writer->arc));
         return -1;
     }
 
-    size = 64 * 1024;
-    buf = g_new0(char, size);
-    while (1) {
-        rv = g_input_stream_read(G_INPUT_STREAM(is),
-                                 buf,
-                                 size,
-                                 NULL,
-                                 &err);
-        if (rv == -1) {
-            g_printerr("%s: cannot read data %s: %s\n",
-                       argv0, abspath, err->message);
+    if (!job->data)
+        return 0;
+
+    data = g_bytes_get_data(job->data, &size);
+    if (size > 0 && archive_write_data(writer->arc, data, size) < 0) {
+        g_printerr("%s: cannot write archive data for %s to %s: %s\n",
+                   argv0, archive_entry_pathname(job->entry),
+                   writer->target, archive_error_string(writer->arc));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static gpointer osinfo_db_export_writer_thread(gpointer opaque)
+{
+    OsinfoDbExportWriter *writer = opaque;
+    gboolean failed;
+
+    for (;;) {
+        OsinfoDbExportJob *job;
+
+        g_mutex_lock(&writer->lock);
+        while (g_queue_is_empty(&writer->jobs) && !writer->finished)
+            g_cond_wait(&writer->cond, &writer->lock);
+        job = g_queue_pop_head(&writer->jobs);
+        failed = writer->failed;
+        g_cond_broadcast(&writer->cond);
+        g_mutex_unlock(&writer->lock);
+
+        if (!job)
+            break;
+
+        /* Once failed, keep draining so the walk never blocks on us */
+        if (!failed && osinfo_db_export_writer_write(writer, job) < 0) {
+            g_mutex_lock(&writer->lock);
+            writer->failed = TRUE;
+            g_cond_broadcast(&writer->cond);
+            g_mutex_unlock(&writer->lock);
+        }
+        osinfo_db_export_job_free(job);
+    }
+
+    g_mutex_lock(&writer->lock);
+    failed = writer->failed;
+    g_mutex_unlock(&writer->lock);
+
+    if (!failed &&
+        archive_write_close(writer->arc) != ARCHIVE_OK) {
+        g_printerr("%s: cannot finish writing archive %s: %s\n",
+                   argv0, writer->target, archive_error_string(writer->arc));
+        g_mutex_lock(&writer->lock);
+        writer->failed = TRUE;
+        g_mutex_unlock(&writer->lock);
+    }
+
+    return NULL;
+}
+
+
+static int osinfo_db_export_writer_open(OsinfoDbExportWriter *writer,
+                                        gboolean checksum)
+{
+    const gchar *filename = writer->target;
+    const gchar *filter = "xz";
+    g_autofree gchar *dirname = NULL;
+    g_autofree gchar *basename = NULL;
+    g_autofree gchar *tmpname = NULL;
+    int r;
+    gsize i;
+
+    if (g_str_equal(filename, "-")) {
+        filename = NULL;
+    } else {
+        for (i = 0; i < G_N_ELEMENTS(osinfo_db_export_filters); i++) {
+            if (g_str_has_suffix(filename, osinfo_db_export_filters[i].suffix)) {
+                filter = osinfo_db_export_filters[i].filter;
+                break;
+            }
+        }
+    }
+
+    if (filter != NULL &&
+        archive_write_add_filter_by_name(writer->arc, filter) != ARCHIVE_OK) {
+        g_printerr("%s: cannot use %s compression for %s: %s\n",
+                   argv0, filter, writer->target, archive_error_string(writer->arc));
+        return -1;
+    }
+    archive_write_set_format_pax(writer->arc);
+
+    if (filename == NULL) {
+        r = archive_write_open_fd(writer->arc, STDOUT_FILENO);
+    } else {
+        dirname = g_path_get_dirname(filename);
+        basename = g_path_get_basename(filename);
+        tmpname = g_strdup_printf(".%s.XXXXXX", basename);
+        writer->tmppath = g_build_filename(dirname, tmpname, NULL);
+        writer->fd = g_mkstemp_full(writer->tmppath, O_WRONLY | O_BINARY, 0666);
+        if (writer->fd < 0) {
+            g_printerr("%s: cannot create temporary file for %s: %s\n",
+                       argv0, writer->target, g_strerror(errno));
+            g_clear_pointer(&writer->tmppath, g_free);
             return -1;
         }
 
-        if (rv == 0)
-            break;
+        if (checksum)
+            writer->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+        /* Same as archive_write_open_filename() for regular files */
+        archive_write_set_bytes_in_last_block(writer->arc, 1);
+        r = archive_write_open(writer->arc, writer, NULL,
+                               osinfo_db_export_writer_output, NULL);
+    }
+
+    if (r != ARCHIVE_OK) {
+        g_printerr("%s: cannot open archive %s: %s\n",
+                   argv0, writer->target, archive_error_string(writer->arc));
+        return -1;
+    }
+
+    writer->thread = g_thread_new("osinfo-db-export",
+                                  osinfo_db_export_writer_thread,
+                                  writer);
+    return 0;
+}
+
+
+/*
+ * Wait for the writer thread to flush all pending entries and
+ * finish the archive. When @discard is set the pending entries are
+ * discarded instead and the archive is not finalized.
+ */
+static int osinfo_db_export_writer_finish(OsinfoDbExportWriter *writer,
+                                          gboolean discard)
+{
+    if (!writer->thread)
+        return -1;
+
+    g_mutex_lock(&writer->lock);
+    writer->finished = TRUE;
+    if (discard)
+        writer->failed = TRUE;
+    g_cond_broadcast(&writer->cond);
+    g_mutex_unlock(&writer->lock);
+
+    g_thread_join(writer->thread);
+    writer->thread = NULL;
+
+    return writer->failed ? -1 : 0;
+}
 
-        if (archive_write_data(arc, buf, rv) < 0) {
-            g_printerr("%s: cannot write archive data for %s to %s: %s\n",
-                       argv0, abspath, target, archive_error_string(arc));
+
+/*
+ * Make a completely written archive durable, and write its
+ * checksum file alongside it if wanted, without publishing
+ * either of them yet.
+ */
+static int osinfo_db_export_writer_close(OsinfoDbExportWriter *writer)
+{
+    g_autofree gchar *sumdata = NULL;
+    g_autofree gchar *basename = NULL;
+    g_autofree gchar *dirname = NULL;
+    g_autofree gchar *tmpname = NULL;
+    gsize len;
+    gsize done = 0;
+    int fd;
+
+    /* Standard output */
+    if (!writer->tmppath)
+        return 0;
+
+#ifndef WIN32
+    if (fsync(writer->fd) < 0) {
+        g_printerr("%s: cannot sync archive %s: %s\n",
+                   argv0, writer->target, g_strerror(errno));
+        return -1;
+    }
+#endif
+    fd = writer->fd;
+    writer->fd = -1;
+    if (close(fd) < 0) {
+        g_printerr("%s: cannot close archive %s: %s\n",
+                   argv0, writer->target, g_strerror(errno));
+        return -1;
+    }
+
+    if (!writer->checksum)
+        return 0;
+
+    basename = g_path_get_basename(writer->target);
+    dirname = g_path_get_dirname(writer->target);
+    sumdata = g_strdup_printf("%s  %s\n",
+                              g_checksum_get_string(writer->checksum),
+                              basename);
+    len = strlen(sumdata);
+
+    tmpname = g_strdup_printf(".%s.sha256.XXXXXX", basename);
+    writer->sumtmppath = g_build_filename(dirname, tmpname, NULL);
+    fd = g_mkstemp_full(writer->sumtmppath, O_WRONLY | O_BINARY, 0666);
+    if (fd < 0) {
+        g_printerr("%s: cannot create temporary checksum file for %s: %s\n",
+                   argv0, writer->target, g_strerror(errno));
+        g_clear_pointer(&writer->sumtmppath, g_free);
+        return -1;
+    }
+
+    while (done < len) {
+        ssize_t rv = write(fd, sumdata + done, len - done);
+        if (rv < 0) {
+            if (errno == EINTR)
+                continue;
+            goto error;
+        }
+        done += rv;
+    }
+#ifndef WIN32
+    if (fsync(fd) < 0)
+        goto error;
+#endif
+    if (close(fd) < 0) {
+        fd = -1;
+        goto error;
+    }
+
+    return 0;
+
+ error:
+    g_printerr("%s: cannot write checksum file %s: %s\n",
+               argv0, writer->sumtmppath, g_strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+
+/*
+ * Move a closed archive into its final location. The checksum
+ * file goes first, so the archive never shows up next to a
+ * checksum file which does not match it.
+ */
+static int osinfo_db_export_writer_commit(OsinfoDbExportWriter *writer)
+{
+    g_autofree gchar *sumpath = NULL;
+    g_autofree gchar *dirname = NULL;
+    int fd;
+
+    /* Standard output */
+    if (!writer->tmppath)
+        return 0;
+
+    if (writer->sumtmppath) {
+        sumpath = g_strdup_printf("%s.sha256", writer->target);
+        if (g_rename(writer->sumtmppath, sumpath) < 0) {
+            g_printerr("%s: cannot rename %s to %s: %s\n",
+                       argv0, writer->sumtmppath, sumpath, g_strerror(errno));
             return -1;
         }
+        g_clear_pointer(&writer->sumtmppath, g_free);
     }
 
+    if (g_rename(writer->tmppath, writer->target) < 0) {
+        g_printerr("%s: cannot rename %s to %s: %s\n",
+                   argv0, writer->tmppath, writer->target, g_strerror(errno));
+        return -1;
+    }
+    g_clear_pointer(&writer->tmppath, g_free);
+
+#ifndef WIN32
+    /* Make the renames themselves durable */
+    dirname = g_path_get_dirname(writer->target);
+    if ((fd = open(dirname, O_RDONLY)) >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+
     return 0;
 }
 
-static int osinfo_db_export_create_dir(const gchar *prefix,
+
+/*
+ * Hand an entry, along with its content if it has any, to all
+ * the writer threads, blocking while their queues are full.
+ */
+static int osinfo_db_export_queue(OsinfoDbExport *export,
+                                  struct archive_entry *entry,
+                                  GBytes *data)
+{
+    gsize i;
+
+    for (i = 0; i < export->writers->len; i++) {
+        OsinfoDbExportWriter *writer = g_ptr_array_index(export->writers, i);
+        gboolean failed;
+
+        g_mutex_lock(&writer->lock);
+        while (writer->jobs.length >= OSINFO_DB_EXPORT_QUEUE_MAX &&
+               !writer->failed)
+            g_cond_wait(&writer->cond, &writer->lock);
+        failed = writer->failed;
+        if (!failed) {
+            OsinfoDbExportJob *job = g_new0(OsinfoDbExportJob, 1);
+
+            job->entry = archive_entry_clone(entry);
+            job->data = data ? g_bytes_ref(data) : NULL;
+            g_queue_push_tail(&writer->jobs, job);
+            g_cond_broadcast(&writer->cond);
+        }
+        g_mutex_unlock(&writer->lock);
+
+        if (failed)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static GBytes *osinfo_db_export_read_file(OsinfoDbExport *export,
+                                          GFile *file,
+                                          const gchar *abspath,
+                                          gboolean xml)
+{
+    g_autoptr(GError) err = NULL;
+    g_autoptr(GBytes) data = NULL;
+    gchar *buf = NULL;
+    gsize size;
+
+    if (!g_file_load_contents(file, NULL, &buf, &size, NULL, &err)) {
+        g_printerr("%s: cannot read file %s: %s\n",
+                   argv0, abspath, err->message);
+        return NULL;
+    }
+    data = g_bytes_new_take(buf, size);
+
+    if (xml && (export->minify || export->rng))
+        return osinfo_db_export_process_xml(export, abspath, data);
+
+    return g_bytes_ref(data);
+}
+
+
+static GBytes *osinfo_db_export_read_entry(OsinfoDbExport *export,
+                                           struct archive *arc,
+                                           struct archive_entry *entry,
+                                           const gchar *source)
+{
+    g_autoptr(GBytes) data = NULL;
+    const gchar *entpath = archive_entry_pathname(entry);
+    gint64 size = archive_entry_size(entry);
+    GByteArray *buf;
+
+    /* The header comes from the source archive, so don't trust it */
+    if (size > OSINFO_DB_EXPORT_ENTRY_MAX) {
+        g_printerr("%s: entry %s in %s is too large\n",
+                   argv0, entpath, source);
+        return NULL;
+    }
+
+    buf = g_byte_array_new();
+    for (;;) {
+        guint done = buf->len;
+        la_ssize_t rv;
+
+        g_byte_array_set_size(buf, done + OSINFO_DB_EXPORT_READSIZE);
+        rv = archive_read_data(arc, buf->data + done, OSINFO_DB_EXPORT_READSIZE);
+        if (rv < 0) {
+            g_printerr("%s: cannot read data for %s from %s: %s\n",
+                       argv0, entpath, source, archive_error_string(arc));
+            g_byte_array_unref(buf);
+            return NULL;
+        }
+        g_byte_array_set_size(buf, done + rv);
+        if (rv == 0)
+            break;
+        if (buf->len > OSINFO_DB_EXPORT_ENTRY_MAX) {
+            g_printerr("%s: entry %s in %s is too large\n",
+                       argv0, entpath, source);
+            g_byte_array_unref(buf);
+            return NULL;
+        }
+    }
+
+    if (size >= 0 && buf->len != size) {
+        g_printerr("%s: cannot read data for %s from %s: %s\n",
+                   argv0, entpath, source, "truncated entry");
+        g_byte_array_unref(buf);
+        return NULL;
+    }
+    data = g_byte_array_free_to_bytes(buf);
+
+    if (g_str_has_suffix(entpath, ".xml") && (export->minify || export->rng))
+        return osinfo_db_export_process_xml(export, entpath, data);
+
+    return g_bytes_ref(data);
+}
+
+
+/*
+ * Whether @relpath, relative to the top of the database, is
+ * filtered out by the --include / --exclude patterns. Include
+ * patterns only apply to files, as any directory may hold some
+ * files which are to be included.
+ */
+static gboolean osinfo_db_export_is_excluded(OsinfoDbExport *export,
+                                             const gchar *relpath,
+                                             gboolean isdir)
+{
+    gboolean included;
+    gsize i;
+
+    for (i = 0; export->excludes && export->excludes[i]; i++) {
+        if (g_pattern_match_simple(export->excludes[i], relpath))
+            return TRUE;
+    }
+
+    if (isdir || !export->includes)
+        return FALSE;
+
+    included = FALSE;
+    for (i = 0; export->includes[i]; i++) {
+        if (g_pattern_match_simple(export->includes[i], relpath))
+            included = TRUE;
+    }
+
+    return !included;
+}
+
+static int osinfo_db_export_create_dir(OsinfoDbExport *export,
                                        GFile *file,
-                                       GFile *base,
-                                       const gchar *abspath,
-                                       const gchar *target,
-                                       struct archive *arc,
-                                       gboolean verbose)
+                                       const gchar *abspath)
 {
     g_autoptr(GFileEnumerator) children = NULL;
     g_autoptr(GError) err = NULL;
@@ -132,7 +746,7 @@ static int osinfo_db_export_create_dir(const gchar *prefix,
 
         child = g_file_enumerator_get_child(children, childinfo);
 
-        export_create_ret = osinfo_db_export_create_file(prefix, child, childinfo, base, target, arc, verbose);
+        export_create_ret = osinfo_db_export_create_file(export, child, childinfo);
 
         if (export_create_ret < 0)
             return -1;
@@ -142,13 +756,9 @@ static int osinfo_db_export_create_dir(const gchar *prefix,
 }
 
 
-static int osinfo_db_export_create_file(const gchar *prefix,
+static int osinfo_db_export_create_file(OsinfoDbExport *export,
                                         GFile *file,
-                                        GFileInfo *arginfo,
-                                        GFile *base,
-                                        const gchar *target,
-                                        struct archive *arc,
-                                        gboolean verbose)
+                                        GFileInfo *arginfo)
 {
     GFileType type = g_file_query_file_type(file,
                                             G_FILE_QUERY_INFO_NONE,
@@ -157,6 +767,7 @@ static int osinfo_db_export_create_file(const gchar *prefix,
     gint ret = 0;
     g_autoptr(GError) err = NULL;
     g_autoptr(GFileInfo) info = NULL;
+    g_autoptr(GBytes) data = NULL;
     g_autofree gchar *abspath = NULL;
     g_autofree gchar *relpath = NULL;
     g_autofree gchar *entpath = NULL;
@@ -164,7 +775,7 @@ static int osinfo_db_export_create_file(const gchar *prefix,
     gboolean has_attribute;
 
     abspath = g_file_get_path(file);
-    relpath = g_file_get_relative_path(base, file);
+    relpath = g_file_get_relative_path(export->base, file);
 
     if (!arginfo) {
         info = g_file_query_info(file,
@@ -187,7 +798,7 @@ static int osinfo_db_export_create_file(const gchar *prefix,
         return -1;
     }
 
-    entpath = g_strdup_printf("%s/%s", prefix, relpath ? relpath : "");
+    entpath = g_strdup_printf("%s/%s", export->prefix, relpath ? relpath : "");
 
     entry = archive_entry_new();
     archive_entry_set_pathname(entry, entpath);
@@ -218,16 +829,28 @@ static int osinfo_db_export_create_file(const gchar *prefix,
             goto cleanup;
         }
 
-        if (verbose) {
+        if (osinfo_db_export_is_excluded(export, relpath, FALSE))
+            goto cleanup;
+
+        if (export->verbose) {
             g_print("%s: r %s\n", argv0, entpath);
         }
+        data = osinfo_db_export_read_file(export, file, abspath,
+                                          g_str_has_suffix(entpath, ".xml"));
+        if (!data) {
+            ret = -1;
+            goto cleanup;
+        }
         archive_entry_set_filetype(entry, AE_IFREG);
         archive_entry_set_perm(entry, 0644);
-        archive_entry_set_size(entry, g_file_info_get_size(info));
+        archive_entry_set_size(entry, g_bytes_get_size(data));
         break;
 
     case G_FILE_TYPE_DIRECTORY:
-        if (verbose) {
+        if (relpath && osinfo_db_export_is_excluded(export, relpath, TRUE))
+            goto cleanup;
+
+        if (export->verbose) {
             g_print("%s: d %s\n", argv0, entpath);
         }
 
@@ -262,31 +885,15 @@ static int osinfo_db_export_create_file(const gchar *prefix,
         goto cleanup;
     }
 
-    if (archive_write_header(arc, entry) != ARCHIVE_OK) {
-        g_printerr("%s: cannot write archive header %s: %s\n",
-                   argv0, target, archive_error_string(arc));
+    if (osinfo_db_export_queue(export, entry, data) < 0) {
         ret = -1;
         goto cleanup;
     }
 
-    switch (type) {
-    case G_FILE_TYPE_REGULAR:
-    case G_FILE_TYPE_SYMBOLIC_LINK:
-        if (osinfo_db_export_create_reg(file, abspath, target, arc) < 0) {
-            ret = -1;
-            goto cleanup;
-        }
-        break;
-
-    case G_FILE_TYPE_DIRECTORY:
-        if (osinfo_db_export_create_dir(prefix, file, base, abspath, target, arc, verbose) < 0) {
-            ret = -1;
-            goto cleanup;
-        }
-        break;
-
-    default:
-        g_assert_not_reached();
+    if (type == G_FILE_TYPE_DIRECTORY &&
+        osinfo_db_export_create_dir(export, file, abspath) < 0) {
+        ret = -1;
+        goto cleanup;
     }
 
 cleanup:
@@ -294,17 +901,15 @@ cleanup:
     return ret;
 }
 
-static int osinfo_db_export_create_version(const gchar *prefix,
-                                           const gchar *version,
-                                           const gchar *target,
-                                           struct archive *arc,
-                                           gboolean verbose)
+static int osinfo_db_export_create_version(OsinfoDbExport *export,
+                                           const gchar *version)
 {
     int ret = -1;
     struct archive_entry *entry = NULL;
     g_autofree gchar *entpath = NULL;
+    g_autoptr(GBytes) data = NULL;
 
-    entpath = g_strdup_printf("%s/VERSION", prefix);
+    entpath = g_strdup_printf("%s/VERSION", export->prefix);
     entry = archive_entry_new();
     archive_entry_set_pathname(entry, entpath);
 
@@ -313,24 +918,16 @@ static int osinfo_db_export_create_version(const gchar *prefix,
     archive_entry_set_mtime(entry, entryts, 0);
     archive_entry_set_birthtime(entry, entryts, 0);
 
-    if (verbose) {
+    if (export->verbose) {
         g_print("%s: r %s\n", argv0, entpath);
     }
+    data = g_bytes_new(version, strlen(version));
     archive_entry_set_filetype(entry, AE_IFREG);
     archive_entry_set_perm(entry, 0644);
-    archive_entry_set_size(entry, strlen(version));
+    archive_entry_set_size(entry, g_bytes_get_size(data));
 
-    if (archive_write_header(arc, entry) != ARCHIVE_OK) {
-        g_printerr("%s: cannot write archive header %s: %s\n",
-                   argv0, target, archive_error_string(arc));
-        goto cleanup;
-    }
-
-    if (archive_write_data(arc, version, strlen(version)) < 0) {
-        g_printerr("%s: cannot write archive data for %s to %s: %s\n",
-                   argv0, entpath, target, archive_error_string(arc));
+    if (osinfo_db_export_queue(export, entry, data) < 0)
         goto cleanup;
-    }
 
     ret = 0;
  cleanup:
@@ -338,35 +935,21 @@ static int osinfo_db_export_create_version(const gchar *prefix,
     return ret;
 }
 
-static int osinfo_db_export_create_license(const gchar *prefix,
-                                           const gchar *license,
-                                           const gchar *target,
-                                           struct archive *arc,
-                                           gboolean verbose)
+static int osinfo_db_export_create_license(OsinfoDbExport *export,
+                                           const gchar *license)
 {
     int ret = -1;
     struct archive_entry *entry = NULL;
     g_autofree gchar *entpath = NULL;
     g_autoptr(GFile) file = NULL;
-    g_autoptr(GFileInfo) info = NULL;
-    g_autoptr(GError) err = NULL;
+    g_autoptr(GBytes) data = NULL;
 
     file = g_file_new_for_path(license);
 
-    info = g_file_query_info(file,
-                             G_FILE_ATTRIBUTE_STANDARD_NAME
-                             ","
-                             G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                             G_FILE_QUERY_INFO_NONE,
-                             NULL,
-                             &err);
-    if (!info) {
-        g_printerr("%s: cannot get file info %s: %s\n",
-                   argv0, license, err->message);
+    if (!(data = osinfo_db_export_read_file(export, file, license, FALSE)))
         goto cleanup;
-    }
 
-    entpath = g_strdup_printf("%s/LICENSE", prefix);
+    entpath = g_strdup_printf("%s/LICENSE", export->prefix);
     entry = archive_entry_new();
     archive_entry_set_pathname(entry, entpath);
 
@@ -375,75 +958,267 @@ static int osinfo_db_export_create_license(const gchar *prefix,
     archive_entry_set_mtime(entry, entryts, 0);
     archive_entry_set_birthtime(entry, entryts, 0);
 
-    if (verbose) {
+    if (export->verbose) {
         g_print("%s: r %s\n", argv0, entpath);
     }
     archive_entry_set_filetype(entry, AE_IFREG);
     archive_entry_set_perm(entry, 0644);
-    archive_entry_set_size(entry, g_file_info_get_size(info));
+    archive_entry_set_size(entry, g_bytes_get_size(data));
 
-    if (archive_write_header(arc, entry) != ARCHIVE_OK) {
-        g_printerr("%s: cannot write archive header %s: %s\n",
-                   argv0, target, archive_error_string(arc));
+    if (osinfo_db_export_queue(export, entry, data) < 0)
         goto cleanup;
+
+    ret = 0;
+ cleanup:
+    archive_entry_free(entry);
+    return ret;
+}
+
+/*
+ * The compressions an archive to repack may use, the same ones it
+ * can be written with. Filters which libarchive would only provide
+ * through an external program, returning ARCHIVE_WARN, are left out.
+ */
+static void osinfo_db_export_support_filters(struct archive *arc)
+{
+    static int (*const filters[])(struct archive *) = {
+        archive_read_support_filter_xz,
+        archive_read_support_filter_zstd,
+        archive_read_support_filter_gzip,
+        archive_read_support_filter_bzip2,
+        archive_read_support_filter_lz4,
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(filters); i++) {
+        struct archive *probe = archive_read_new();
+        int r = filters[i](probe);
+
+        archive_read_free(probe);
+        if (r == ARCHIVE_OK)
+            filters[i](arc);
+    }
+}
+
+/*
+ * Copy the entries of an existing archive into the new archive(s),
+ * one at a time, without extracting them anywhere. The top level
+ * directory is renamed to match the new version, if one was given,
+ * in which case the VERSION file is regenerated too. The original
+ * top level directory name is stored in @srcprefix.
+ */
+static int osinfo_db_export_repack(OsinfoDbExport *export,
+                                   const gchar *source,
+                                   gboolean newversion,
+                                   gboolean newlicense,
+                                   gchar **srcprefix)
+{
+    struct archive *arc;
+    struct archive_entry *entry;
+    g_autoptr(GPtrArray) skipdirs = NULL;
+    int ret = -1;
+    int r;
+
+    skipdirs = g_ptr_array_new_with_free_func(g_free);
+    arc = archive_read_new();
+    archive_read_support_format_tar(arc);
+    osinfo_db_export_support_filters(arc);
+
+    /* A NULL filename makes libarchive read from stdin */
+    if ((r = archive_read_open_filename(arc,
+                                        g_str_equal(source, "-") ? NULL : source,
+                                        64 * 1024)) != ARCHIVE_OK) {
+        g_printerr("%s: cannot open archive %s: %s\n",
+                   argv0, source, archive_error_string(arc));
+        goto cleanup;
+    }
+
+    for (;;) {
+        g_autoptr(GBytes) data = NULL;
+        g_autofree gchar *entprefix = NULL;
+        g_autofree gchar *entpath = NULL;
+        struct archive_entry *newentry;
+        gchar *relpath;
+        gboolean skip = FALSE;
+        gsize i;
+        int type;
+
+        r = archive_read_next_header(arc, &entry);
+        if (r == ARCHIVE_EOF)
+            break;
+        if (r != ARCHIVE_OK) {
+            g_printerr("%s: cannot read next archive entry in %s: %s\n",
+                       argv0, source, archive_error_string(arc));
+            goto cleanup;
+        }
+
+        entprefix = g_strdup(archive_entry_pathname(entry));
+        relpath = strchr(entprefix, '/');
+        if (relpath) {
+            *relpath = '\0';
+            relpath++;
+        } else {
+            relpath = entprefix + strlen(entprefix);
+        }
+        if (g_str_has_suffix(relpath, "/"))
+            relpath[strlen(relpath) - 1] = '\0';
+        if (!*srcprefix)
+            *srcprefix = g_strdup(entprefix);
+        entpath = g_strdup_printf("%s/%s",
+                                  export->prefix ? export->prefix : entprefix,
+                                  relpath);
+        type = archive_entry_filetype(entry) & AE_IFMT;
+
+        if ((newversion && g_str_equal(relpath, "VERSION")) ||
+            (newlicense && g_str_equal(relpath, "LICENSE")))
+            continue;
+
+        /* Entries are not nested, so track the excluded directories */
+        for (i = 0; i < skipdirs->len && !skip; i++) {
+            if (g_str_has_prefix(relpath, g_ptr_array_index(skipdirs, i)))
+                skip = TRUE;
+        }
+        if (skip)
+            continue;
+
+        if (*relpath &&
+            osinfo_db_export_is_excluded(export, relpath, type == AE_IFDIR)) {
+            if (type == AE_IFDIR)
+                g_ptr_array_add(skipdirs, g_strdup_printf("%s/", relpath));
+            continue;
+        }
+
+        switch (type) {
+        case AE_IFREG:
+            if (export->verbose) {
+                g_print("%s: r %s\n", argv0, entpath);
+            }
+            if (!(data = osinfo_db_export_read_entry(export, arc, entry, source)))
+                goto cleanup;
+            break;
+
+        case AE_IFDIR:
+            if (export->verbose) {
+                g_print("%s: d %s\n", argv0, entpath);
+            }
+            break;
+
+        default:
+            g_printerr("%s: unsupported file type for %s\n",
+                       argv0, archive_entry_pathname(entry));
+            goto cleanup;
+        }
+
+        newentry = archive_entry_new();
+        archive_entry_set_pathname(newentry, entpath);
+
+        archive_entry_set_atime(newentry, entryts, 0);
+        archive_entry_set_ctime(newentry, entryts, 0);
+        archive_entry_set_mtime(newentry, entryts, 0);
+        archive_entry_set_birthtime(newentry, entryts, 0);
+
+        archive_entry_set_filetype(newentry, type);
+        archive_entry_set_perm(newentry, type == AE_IFDIR ? 0755 : 0644);
+        archive_entry_set_size(newentry, data ? g_bytes_get_size(data) : 0);
+
+        r = osinfo_db_export_queue(export, newentry, data);
+        archive_entry_free(newentry);
+        if (r < 0)
+            goto cleanup;
     }
 
-    if (osinfo_db_export_create_reg(file, license, target, arc) < 0)
+    if (archive_read_close(arc) != ARCHIVE_OK) {
+        g_printerr("%s: cannot finish reading archive %s: %s\n",
+                   argv0, source, archive_error_string(arc));
         goto cleanup;
+    }
 
     ret = 0;
  cleanup:
-    archive_entry_free(entry);
+    archive_read_free(arc);
     return ret;
 }
 
-static int osinfo_db_export_create(const gchar *prefix,
+static int osinfo_db_export_create(OsinfoDbExport *export,
                                    const gchar *version,
                                    GFile *source,
-                                   const gchar *target,
+                                   const gchar *repack,
+                                   GPtrArray *targets,
                                    const gchar *license,
-                                   gboolean verbose)
+                                   GFile *schema,
+                                   gboolean checksum)
 {
-    struct archive *arc;
+    g_autoptr(GError) err = NULL;
+    g_autofree gchar *srcprefix = NULL;
     int ret = -1;
-    int r;
+    gsize i;
 
-    arc = archive_write_new();
+    export->base = source;
+    export->writers = g_ptr_array_new_with_free_func((GDestroyNotify)osinfo_db_export_writer_free);
 
-    archive_write_add_filter_xz(arc);
-    archive_write_set_format_pax(arc);
+    if (schema && !(export->rng = osinfo_db_schema_new(schema, &err))) {
+        g_printerr("%s: %s\n", argv0, err->message);
+        goto cleanup;
+    }
 
-    if (target != NULL && g_str_equal(target, "-"))
-        target = NULL;
+    for (i = 0; i < targets->len; i++) {
+        OsinfoDbExportWriter *writer;
 
-    if ((r = archive_write_open_filename(arc, target)) != ARCHIVE_OK) {
-        g_printerr("%s: cannot open archive %s: %s\n",
-                   argv0, target, archive_error_string(arc));
-        goto cleanup;
+        writer = osinfo_db_export_writer_new(g_ptr_array_index(targets, i));
+        g_ptr_array_add(export->writers, writer);
+        if (osinfo_db_export_writer_open(writer, checksum) < 0)
+            goto cleanup;
     }
 
-    if (osinfo_db_export_create_file(prefix, source, NULL, source, target, arc, verbose) < 0) {
+    if (repack) {
+        if (osinfo_db_export_repack(export, repack,
+                                    version != NULL, license != NULL,
+                                    &srcprefix) < 0)
+            goto cleanup;
+        if (!export->prefix)
+            export->prefix = srcprefix;
+    } else if (osinfo_db_export_create_file(export, source, NULL) < 0) {
         goto cleanup;
     }
 
-    if (osinfo_db_export_create_version(prefix, version, target, arc, verbose) < 0) {
+    if (version != NULL &&
+        osinfo_db_export_create_version(export, version) < 0) {
         goto cleanup;
     }
 
     if (license != NULL &&
-        osinfo_db_export_create_license(prefix, license, target, arc, verbose) < 0) {
+        osinfo_db_export_create_license(export, license) < 0) {
         goto cleanup;
     }
 
-    if (archive_write_close(arc) != ARCHIVE_OK) {
-        g_printerr("%s: cannot finish writing archive %s: %s\n",
-                   argv0, target, archive_error_string(arc));
-        goto cleanup;
+    if (export->minify && export->verbose) {
+        g_print("%s: minified XML from %" G_GSIZE_FORMAT " to %" G_GSIZE_FORMAT " bytes\n",
+                argv0, minify_insize, minify_outsize);
     }
 
     ret = 0;
  cleanup:
-    archive_write_free(arc);
+    for (i = 0; i < export->writers->len; i++) {
+        OsinfoDbExportWriter *writer = g_ptr_array_index(export->writers, i);
+
+        if (osinfo_db_export_writer_finish(writer, ret < 0) < 0)
+            ret = -1;
+    }
+    /* Only publish archives once all of them are complete and synced */
+    for (i = 0; ret == 0 && i < export->writers->len; i++) {
+        OsinfoDbExportWriter *writer = g_ptr_array_index(export->writers, i);
+
+        if (osinfo_db_export_writer_close(writer) < 0)
+            ret = -1;
+    }
+    for (i = 0; ret == 0 && i < export->writers->len; i++) {
+        OsinfoDbExportWriter *writer = g_ptr_array_index(export->writers, i);
+
+        if (osinfo_db_export_writer_commit(writer) < 0)
+            ret = -1;
+    }
+    g_ptr_array_free(export->writers, TRUE);
+    osinfo_db_schema_free(export->rng);
     return ret;
 }
 
@@ -471,13 +1246,24 @@ gint main(gint argc, gchar **argv)
     gboolean user = FALSE;
     gboolean local = FALSE;
     gboolean system = FALSE;
-    g_autofree gchar *archive = NULL;
+    gboolean minify = FALSE;
+    gboolean validate = FALSE;
+    gboolean checksum = FALSE;
+    g_autoptr(GFile) schema = NULL;
+    g_autoptr(GPtrArray) targets = NULL;
+    g_auto(GStrv) outputs = NULL;
+    g_auto(GStrv) includes = NULL;
+    g_auto(GStrv) excludes = NULL;
+    OsinfoDbExport export = { 0 };
     g_autofree gchar *prefix = NULL;
     g_autofree gchar *root = g_strdup("");
     g_autofree gchar *custom = NULL;
     g_autofree gchar *version = NULL;
     g_autofree gchar *license = NULL;
+    g_autofree gchar *repack = NULL;
     int locs = 0;
+    int stdouts = 0;
+    gsize i;
     const GOptionEntry entries[] = {
       { "verbose", 'v', 0, G_OPTION_ARG_NONE, (void*)&verbose,
         N_("Verbose progress information"), NULL, },
@@ -495,6 +1281,20 @@ gint main(gint argc, gchar **argv)
         N_("Export the osinfo-db root directory"), NULL, },
       { "license", 0, 0, G_OPTION_ARG_STRING, &license,
         N_("License file"), NULL, },
+      { "minify", 0, 0, G_OPTION_ARG_NONE, (void *)&minify,
+        N_("Strip comments and whitespace from XML files"), NULL, },
+      { "validate", 0, 0, G_OPTION_ARG_NONE, (void *)&validate,
+        N_("Validate XML files against the schema while exporting"), NULL, },
+      { "output", 'o', 0, G_OPTION_ARG_FILENAME_ARRAY, &outputs,
+        N_("Write an archive file, may be given multiple times"), NULL, },
+      { "checksum", 0, 0, G_OPTION_ARG_NONE, (void *)&checksum,
+        N_("Write a SHA-256 checksum file alongside each archive"), NULL, },
+      { "repack", 0, 0, G_OPTION_ARG_FILENAME, &repack,
+        N_("Read the files from an existing archive"), NULL, },
+      { "include", 0, 0, G_OPTION_ARG_STRING_ARRAY, &includes,
+        N_("Only archive files matching a pattern"), NULL, },
+      { "exclude", 0, 0, G_OPTION_ARG_STRING_ARRAY, &excludes,
+        N_("Do not archive files or directories matching a pattern"), NULL, },
       { NULL, 0, 0, 0, NULL, NULL, NULL },
     };
     argv0 = argv[0];
@@ -533,20 +1333,70 @@ gint main(gint argc, gchar **argv)
         g_printerr(_("Only one of --user, --local, --system & --dir can be used\n"));
         return EXIT_FAILURE;
     }
+    if (repack && (locs || !g_str_equal(root, ""))) {
+        g_printerr(_("%s: --repack cannot be combined with a database location\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
 
     entryts = time(NULL);
-    if (version == NULL) {
+    /* When repacking, keep the existing version unless told otherwise */
+    if (version == NULL && !repack) {
         version = osinfo_db_version();
     }
-    prefix = g_strdup_printf("osinfo-db-%s", version);
-    if (argc == 2) {
-        archive = g_strdup(argv[1]);
-    } else {
-        archive = g_strdup_printf("%s.tar.xz", prefix);
+    if (version)
+        prefix = g_strdup_printf("osinfo-db-%s", version);
+    targets = g_ptr_array_new_with_free_func(g_free);
+    if (argc == 2)
+        g_ptr_array_add(targets, g_strdup(argv[1]));
+    for (i = 0; outputs && outputs[i]; i++)
+        g_ptr_array_add(targets, g_strdup(outputs[i]));
+    if (targets->len == 0) {
+        if (!prefix) {
+            g_printerr(_("%s: an archive file must be given with --repack unless --version is used\n"),
+                       argv0);
+            return EXIT_FAILURE;
+        }
+        g_ptr_array_add(targets, g_strdup_printf("%s.tar.xz", prefix));
     }
-    dir = osinfo_db_get_path(root, user, local, system, custom);
-    if (osinfo_db_export_create(prefix, version, dir, archive,
-                                license, verbose) < 0)
+
+    for (i = 0; i < targets->len; i++) {
+        if (g_str_equal(g_ptr_array_index(targets, i), "-"))
+            stdouts++;
+    }
+    if (stdouts > 1) {
+        g_printerr(_("%s: only one archive can be written to standard output\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
+    if (stdouts && checksum) {
+        g_printerr(_("%s: --checksum cannot be used when writing to standard output\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
+    if (!repack)
+        dir = osinfo_db_get_path(root, user, local, system, custom);
+    if (validate) {
+        /* The location exported, then the ones it overrides */
+        schema = osinfo_db_get_file(root,
+                                    user || custom,
+                                    local || user || custom,
+                                    system || local || user || custom,
+                                    custom,
+                                    "schema/osinfo.rng", &error);
+        if (!schema) {
+            g_printerr("%s: %s\n", argv0, error->message);
+            return EXIT_FAILURE;
+        }
+    }
+
+    export.prefix = prefix;
+    export.minify = minify;
+    export.includes = includes;
+    export.excludes = excludes;
+    export.verbose = verbose;
+    if (osinfo_db_export_create(&export, version, dir, repack, targets,
+                                license, schema, checksum) < 0)
         return EXIT_FAILURE;
 
     return EXIT_SUCCESS;
@@ -564,6 +1414,10 @@ osinfo-db-export - Export to a osinfo database archive
 
 osinfo-db-export [OPTIONS...] [ARCHIVE-FILE]
 
+osinfo-db-export [OPTIONS...] -o ARCHIVE-FILE1 [-o ARCHIVE-FILE2...]
+
+osinfo-db-export [OPTIONS...] --repack=SOURCE-ARCHIVE ARCHIVE-FILE
+
 =head1 DESCRIPTION
 
 The B<osinfo-db-export> tool will create an osinfo database
@@ -598,6 +1452,18 @@ will be used.
 
 If no B<ARCHIVE-FILE> path is given, an automatically generated
 filename will be used, taking the format B<osinfo-db-$VERSION.tar.xz>.
+If B<ARCHIVE-FILE> is -, the archive is written to standard output.
+
+The compression used for an archive is picked from the suffix of
+its filename: B<.tar.xz>, B<.tar.zst>, B<.tar.gz> or B<.tgz>,
+B<.tar.bz2> and B<.tar.lz4> are recognized. Any other filename,
+including a plain B<.tar>, or standard output, gets xz compression.
+
+Archives are first written to a temporary file in the same
+directory as B<ARCHIVE-FILE>, and only synced to disk and renamed
+into place once every requested archive has been completed. An
+interrupted or failed export therefore never leaves a truncated
+archive under the final filename, nor replaces an existing one.
 
 =head1 OPTIONS
 
@@ -640,6 +1506,75 @@ will be set to the current date in the format B<YYYYMMDD>.
 Add C<LICENSE-FILE> to the generated archive as an entry
 named "LICENSE".
 
+=item B<--minify>
+
+Re-serialize each XML file before adding it to the archive,
+dropping comments and the whitespace used for indentation.
+This produces a smaller archive which is also quicker for
+applications to parse once imported. The files remain valid
+against the schema, but are no longer convenient to read or
+edit by hand.
+
+=item B<--validate>
+
+Validate each XML file against the RNG schema while it is being
+archived, using the same lookup rules for B<schema/osinfo.rng> as
+C<osinfo-db-validate(1)>. The schema is loaded once and each
+document is checked from the same in-memory copy that is written
+to the archive, so no separate validation pass over the files is
+needed. The export is aborted, and the partially written archive
+removed, on the first document which fails validation.
+
+=item B<-o ARCHIVE-FILE>, B<--output=ARCHIVE-FILE>
+
+Write the archive to B<ARCHIVE-FILE>. This option may be given
+multiple times, in addition to the positional B<ARCHIVE-FILE>, to
+produce several archives, typically using different compression
+formats, from a single pass over the database files. Each archive
+is compressed in its own thread.
+
+=item B<--checksum>
+
+Alongside each archive, write a B<ARCHIVE-FILE.sha256> file in the
+format used by C<sha256sum(1)>. The digest is computed while the
+archive data is being written, and the file is renamed into place
+just before the archive, so a new archive never sits next to a stale
+checksum file. This cannot be used when writing to standard output.
+
+=item B<--repack=SOURCE-ARCHIVE>
+
+Build the archive from the content of the existing database archive
+B<SOURCE-ARCHIVE>, instead of a database location, for example to
+convert it to a different compression format or to produce a subset
+of it. Entries are streamed from one archive to the other without
+being extracted to disk. Any compression B<osinfo-db-export> can
+write is accepted, and - reads from standard input. Entries
+larger than 64 MiB are rejected.
+
+The version of B<SOURCE-ARCHIVE> is preserved, unless B<--version>
+is given, in which case the top level directory is renamed and the
+B<VERSION> entry replaced to match. Similarly, the B<LICENSE> entry
+is only replaced when B<--license> is given. Without B<--version>
+an explicit B<ARCHIVE-FILE> is required. This option cannot be
+combined with B<--user>, B<--local>, B<--system>, B<--dir> or
+B<--root>.
+
+=item B<--include=PATTERN>
+
+Only archive files whose path, relative to the top of the database
+(for example B<os/fedoraproject.org/fedora-39.xml>), matches the
+glob-style B<PATTERN>, in which B<*> and B<?> also match B</>.
+Directories are always traversed. This option may be given
+multiple times, in which case a file matching any of the patterns
+is archived.
+
+=item B<--exclude=PATTERN>
+
+Do not archive files or directories whose relative path matches
+B<PATTERN>. An excluded directory is skipped along with all of its
+content. This option may be given multiple times, and takes
+precedence over B<--include>.
+
 =item B<-v>, B<--verbose>
 
 Display verbose progress information when archiving files
@@ -25,28 +25,665 @@
 #include <glib-object.h>
 #include <json-glib/json-glib.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <archive.h>
 #include <archive_entry.h>
 #include <libsoup/soup.h>
+#include <glib/gstdio.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+#ifndef WIN32
+# include <sys/file.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
 
 #include "osinfo-db-util.h"
+#include "osinfo-db-xml.h"
 
 #define LATEST_URI "https://db.libosinfo.org/latest.json"
 #define NIGHTLY_URI "https://db.libosinfo.org/nightly.json"
 #define VERSION_FILE "VERSION"
+#define SCHEMA_FILE "schema/osinfo.rng"
 
 #if SOUP_MAJOR_VERSION < 3
 # define soup_message_get_status(message) message->status_code
+# define soup_message_get_request_headers(message) message->request_headers
 # define soup_message_get_response_headers(message) message->response_headers
+
+typedef SoupMessage SoupServerMessage;
+# define soup_server_message_get_method(message) message->method
+# define soup_server_message_get_request_headers(message) message->request_headers
+# define soup_server_message_get_response_headers(message) message->response_headers
+# define soup_server_message_set_status(message, status, phrase) \
+    soup_message_set_status(message, status)
+# define soup_server_message_set_response soup_message_set_response
+# define soup_server_message_get_response_body(message) message->response_body
+
+static void soup_message_body_append_bytes(SoupMessageBody *body,
+                                           GBytes *bytes)
+{
+    SoupBuffer *buffer =
+        soup_buffer_new_with_owner(g_bytes_get_data(bytes, NULL),
+                                   g_bytes_get_size(bytes),
+                                   g_bytes_ref(bytes),
+                                   (GDestroyNotify)g_bytes_unref);
+
+    soup_message_body_append_buffer(body, buffer);
+    soup_buffer_free(buffer);
+}
+#endif
+
+/* Exit status of --check-only when a newer database is available */
+#define OSINFO_DB_IMPORT_EXIT_UPDATE 100
+
+#define OSINFO_DB_IMPORT_CACHE_GROUP "metadata"
+#define OSINFO_DB_IMPORT_INDEX_GROUP "archive"
+
+/* Default upper bound on the size of the downloaded archives kept */
+#define OSINFO_DB_IMPORT_CACHE_SIZE (32 * 1024 * 1024)
+
+/* Largest file accepted from an archive */
+#define OSINFO_DB_IMPORT_ENTRY_MAX (64 * 1024 * 1024)
+
+/* Largest release information accepted, it is only a few lines */
+#define OSINFO_DB_IMPORT_METADATA_MAX (1024 * 1024)
+
+/* How long --serve trusts the release information, in seconds */
+#define OSINFO_DB_IMPORT_SERVE_INTERVAL (5 * 60)
+
+#ifndef RENAME_EXCHANGE
+# define RENAME_EXCHANGE (1 << 1)
+#endif
+
+#if defined(__linux__) && !defined(FICLONE)
+# define FICLONE _IOW(0x94, 9, int)
+#endif
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+#if defined(__linux__) && !defined(IOPRIO_CLASS_SHIFT)
+# define IOPRIO_CLASS_SHIFT 13
+# define IOPRIO_CLASS_BE 2
+# define IOPRIO_CLASS_IDLE 3
+# define IOPRIO_WHO_PROCESS 1
 #endif
 
 const char *argv0;
 static SoupSession *session = NULL;
 
-static int osinfo_db_import_create_reg(GFile *file,
+typedef enum {
+    OSINFO_DB_IMPORT_SYNC_NONE,
+    OSINFO_DB_IMPORT_SYNC_BATCH,
+    OSINFO_DB_IMPORT_SYNC_FULL,
+} OsinfoDbImportSync;
+
+typedef struct _OsinfoDbImportPool OsinfoDbImportPool;
+typedef struct _OsinfoDbImportContentStore OsinfoDbImportContentStore;
+typedef struct _OsinfoDbImportArchiveCache OsinfoDbImportArchiveCache;
+
+typedef struct _OsinfoDbImport OsinfoDbImport;
+struct _OsinfoDbImport {
+    OsinfoDbImportSync sync;
+    guint jobs;
+    gboolean skip_unchanged;
+    gboolean verbose;
+
+    /* Updated atomically, as files may be written by several threads */
+    gint nwritten;
+    gint nunchanged;
+    gint nnew;
+
+    /* Relative paths found in the archive, only kept with --prune */
+    GHashTable *seen;
+    guint npruned;
+
+    /* Relative paths already extracted, with several archives */
+    GHashTable *claimed;
+
+    /* Writer threads, only used with --jobs greater than 1 */
+    OsinfoDbImportPool *pool;
+
+    /* Expected SHA-256 digest and size of the archive, if known */
+    const gchar *checksum;
+    goffset size;
+
+    /* Where file content is shared from, with --content-store */
+    OsinfoDbImportContentStore *content;
+
+    /*
+     * Where downloaded archives are kept, unless --cache-size is 0,
+     * and the downloads complete and verified so far, which are only
+     * added to it once the import has succeeded.
+     */
+    OsinfoDbImportArchiveCache *archives;
+    GPtrArray *downloads;
+
+    /* Token bucket limiting the bytes written per second, if @rate */
+    guint64 rate;
+    gint64 tokens;
+    gint64 refilled;
+    GMutex ratelock;
+
+    /*
+     * With --validate, the schema from the archive, or @schemafile
+     * if it has none, and the XML files extracted before the schema
+     * was found, to be validated once it is.
+     */
+    gboolean validate;
+    OsinfoDbSchema *schema;
+    GFile *schemafile;
+    GHashTable *pending;
+};
+
+typedef struct _OsinfoDbImportDirCache OsinfoDbImportDirCache;
+
+/*
+ * A database directory being imported into. With --atomic, entries
+ * are extracted into a staging directory next to it, which is then
+ * swapped with the live directory once the whole archive is in.
+ * After the swap, the staging directory holds the previous database
+ * until every target has been committed.
+ */
+typedef struct _OsinfoDbImportTarget OsinfoDbImportTarget;
+struct _OsinfoDbImportTarget {
+    GFile *dir;
+    gchar *path;
+    gchar *stagingpath;
+    GFile *staging;
+    gboolean committed;
+    OsinfoDbImportDirCache *dirs;
+};
+
+/* Where the entries of the archive are currently written to */
+static GFile *osinfo_db_import_target_root(OsinfoDbImportTarget *target)
+{
+    return target->staging ? target->staging : target->dir;
+}
+
+/* Small files still cost a whole block, on top of their inode */
+#define OSINFO_DB_IMPORT_THROTTLE_BLOCK 4096
+
+/*
+ * Wait until @size more bytes can be written within --max-write-rate.
+ * The bucket holds at most one second worth of writes, so short
+ * bursts go through straight away, while a sustained stream of
+ * files is spread out evenly. The bytes are taken from the bucket
+ * before sleeping, so that writer threads queue up behind each
+ * other instead of all waking up at once.
+ */
+static void osinfo_db_import_throttle(OsinfoDbImport *import,
+                                      goffset size)
+{
+    gint64 now;
+    gint64 elapsed;
+    gint64 wait = 0;
+
+    if (!import->rate)
+        return;
+
+    size = MAX(size, OSINFO_DB_IMPORT_THROTTLE_BLOCK);
+
+    g_mutex_lock(&import->ratelock);
+    now = g_get_monotonic_time();
+    elapsed = MIN(now - import->refilled, G_USEC_PER_SEC);
+    import->tokens = MIN(import->tokens + elapsed * (gint64)import->rate / G_USEC_PER_SEC,
+                         (gint64)import->rate);
+    import->refilled = now;
+    import->tokens -= size;
+    if (import->tokens < 0)
+        wait = -import->tokens * G_USEC_PER_SEC / (gint64)import->rate;
+    g_mutex_unlock(&import->ratelock);
+
+    if (wait > 0)
+        g_usleep(wait);
+}
+
+#ifndef WIN32
+static int osinfo_db_import_fsync_path(const gchar *path)
+{
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0 ||
+        fsync(fd) < 0) {
+        g_printerr("%s: cannot sync %s: %s\n",
+                   argv0, path, g_strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+/*
+ * Flush everything written below @path in one go. On Linux syncfs()
+ * writes back the whole filesystem, which is far cheaper than many
+ * individual fsync() calls. Elsewhere each entry is synced in turn.
+ */
+static int osinfo_db_import_sync_tree(const gchar *path)
+{
+# if defined(__linux__) && defined(SYS_syncfs)
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0 ||
+        syscall(SYS_syncfs, fd) < 0) {
+        g_printerr("%s: cannot sync %s: %s\n",
+                   argv0, path, g_strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+# else
+    g_autoptr(GDir) dir = NULL;
+    const gchar *name;
+
+    if (g_file_test(path, G_FILE_TEST_IS_DIR) &&
+        (dir = g_dir_open(path, 0, NULL)) != NULL) {
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            g_autofree gchar *child = g_build_filename(path, name, NULL);
+
+            if (osinfo_db_import_sync_tree(child) < 0)
+                return -1;
+        }
+    }
+
+    return osinfo_db_import_fsync_path(path);
+# endif
+}
+#endif /* !WIN32 */
+
+/*
+ * Read the data of the current entry into memory. Entries in the
+ * database are small, so this is cheaper than comparing the archive
+ * and the installed file block by block as they are decompressed.
+ */
+static GBytes *osinfo_db_import_read_entry(struct archive *arc,
+                                           struct archive_entry *entry)
+{
+    gint64 total = archive_entry_size(entry);
+    gchar *data;
+    int r;
+    const void *buf;
+    size_t size;
+    gint64 offset;
+
+    /* The archive may come from anywhere, so bound the header size */
+    if (total < 0 || total > OSINFO_DB_IMPORT_ENTRY_MAX) {
+        g_printerr("%s: invalid size for %s\n",
+                   argv0, archive_entry_pathname(entry));
+        return NULL;
+    }
+
+    if (!(data = g_try_malloc0(total ? total : 1))) {
+        g_printerr("%s: cannot allocate memory for %s\n",
+                   argv0, archive_entry_pathname(entry));
+        return NULL;
+    }
+    for (;;) {
+        r = archive_read_data_block(arc, &buf, &size, &offset);
+        if (r == ARCHIVE_EOF)
+            break;
+        if (r != ARCHIVE_OK || offset < 0 || offset + size > total) {
+            g_printerr("%s: cannot read data for %s\n",
+                       argv0, archive_entry_pathname(entry));
+            g_free(data);
+            return NULL;
+        }
+        memcpy(data + offset, buf, size);
+    }
+
+    return g_bytes_new_take(data, total);
+}
+
+/*
+ * Whether @file exists with exactly the content @data. The sizes are
+ * compared first, so most modified files are detected without
+ * reading them at all.
+ */
+static gboolean osinfo_db_import_is_unchanged(GFile *file,
+                                              GBytes *data,
+                                              gboolean *exists)
+{
+    g_autoptr(GFileInfo) info = NULL;
+    g_autoptr(GFileInputStream) is = NULL;
+    g_autofree gchar *buf = NULL;
+    const gchar *expected;
+    gsize size;
+    gsize done = 0;
+
+    info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                             G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    *exists = info != NULL;
+    if (!info)
+        return FALSE;
+
+    expected = g_bytes_get_data(data, &size);
+    if (g_file_info_get_size(info) != size)
+        return FALSE;
+
+    if (!(is = g_file_read(file, NULL, NULL)))
+        return FALSE;
+
+    buf = g_malloc(64 * 1024);
+    while (done < size) {
+        gssize len = g_input_stream_read(G_INPUT_STREAM(is), buf,
+                                         MIN(size - done, 64 * 1024),
+                                         NULL, NULL);
+        if (len <= 0 || memcmp(buf, expected + done, len) != 0)
+            return FALSE;
+        done += len;
+    }
+
+    return TRUE;
+}
+
+#ifndef WIN32
+/*
+ * Directories are kept open so that entries can be created relative
+ * to their parent with openat() and mkdirat(), instead of resolving
+ * and checking every ancestor each time. Archives list the content
+ * of a directory together, so a handful of them is plenty.
+ */
+# define OSINFO_DB_IMPORT_DIRS_MAX 16
+
+typedef struct _OsinfoDbImportDir OsinfoDbImportDir;
+struct _OsinfoDbImportDir {
+    gchar *relpath;
+    int fd;
+    guint refs;
+    guint64 used;
+    gboolean cached;
+};
+
+struct _OsinfoDbImportDirCache {
+    gchar *path;
+    int rootfd;
+    GMutex lock;
+    guint64 clock;
+    OsinfoDbImportDir dirs[OSINFO_DB_IMPORT_DIRS_MAX];
+};
+
+static OsinfoDbImportDirCache *
+osinfo_db_import_dir_cache_new(GFile *root)
+{
+    OsinfoDbImportDirCache *cache;
+    g_autofree gchar *path = g_file_get_path(root);
+    int fd;
+    gsize i;
+
+    if (g_mkdir_with_parents(path, 0755) < 0 ||
+        (fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        g_printerr("%s: cannot open directory %s: %s\n",
+                   argv0, path, g_strerror(errno));
+        return NULL;
+    }
+
+    cache = g_new0(OsinfoDbImportDirCache, 1);
+    cache->path = g_strdup(path);
+    cache->rootfd = fd;
+    g_mutex_init(&cache->lock);
+    for (i = 0; i < OSINFO_DB_IMPORT_DIRS_MAX; i++)
+        cache->dirs[i].fd = -1;
+
+    return cache;
+}
+
+static void
+osinfo_db_import_dir_cache_free(OsinfoDbImportDirCache *cache)
+{
+    gsize i;
+
+    if (!cache)
+        return;
+
+    for (i = 0; i < OSINFO_DB_IMPORT_DIRS_MAX; i++) {
+        if (cache->dirs[i].fd >= 0)
+            close(cache->dirs[i].fd);
+        g_free(cache->dirs[i].relpath);
+    }
+    close(cache->rootfd);
+    g_mutex_clear(&cache->lock);
+    g_free(cache->path);
+    g_free(cache);
+}
+
+/*
+ * Get a reference on the directory @relpath, opening it if it is not
+ * cached yet. The least recently used unreferenced directory is
+ * evicted to make room, and if all of them are in use the returned
+ * directory is simply closed again once released.
+ */
+static OsinfoDbImportDir *
+osinfo_db_import_dir_get(OsinfoDbImportDirCache *cache,
+                         const gchar *relpath)
+{
+    OsinfoDbImportDir *dir = NULL;
+    OsinfoDbImportDir *victim = NULL;
+    int fd;
+    gsize i;
+
+    g_mutex_lock(&cache->lock);
+    for (i = 0; i < OSINFO_DB_IMPORT_DIRS_MAX && !dir; i++) {
+        OsinfoDbImportDir *tmp = &cache->dirs[i];
+
+        if (tmp->fd >= 0 && g_str_equal(tmp->relpath, relpath))
+            dir = tmp;
+        else if (tmp->refs == 0 && (!victim || tmp->used < victim->used))
+            victim = tmp;
+    }
+
+    if (!dir) {
+        fd = openat(cache->rootfd, *relpath ? relpath : ".",
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT) {
+            /* The archive has no entry for the directory itself */
+            g_autofree gchar *path = g_build_filename(cache->path, relpath, NULL);
+
+            if (g_mkdir_with_parents(path, 0755) == 0)
+                fd = openat(cache->rootfd, relpath,
+                            O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+        if (fd < 0) {
+            g_printerr("%s: cannot open directory %s/%s: %s\n",
+                       argv0, cache->path, relpath, g_strerror(errno));
+            g_mutex_unlock(&cache->lock);
+            return NULL;
+        }
+
+        if (victim) {
+            dir = victim;
+            if (dir->fd >= 0)
+                close(dir->fd);
+            g_free(dir->relpath);
+            dir->cached = TRUE;
+        } else {
+            dir = g_new0(OsinfoDbImportDir, 1);
+        }
+        dir->relpath = g_strdup(relpath);
+        dir->fd = fd;
+    }
+
+    dir->refs++;
+    dir->used = ++cache->clock;
+    g_mutex_unlock(&cache->lock);
+
+    return dir;
+}
+
+static void
+osinfo_db_import_dir_put(OsinfoDbImportDirCache *cache,
+                         OsinfoDbImportDir *dir)
+{
+    g_mutex_lock(&cache->lock);
+    dir->refs--;
+    if (!dir->cached) {
+        close(dir->fd);
+        g_free(dir->relpath);
+        g_free(dir);
+    }
+    g_mutex_unlock(&cache->lock);
+}
+
+/* Get the directory containing @relpath, and the name within it */
+static OsinfoDbImportDir *
+osinfo_db_import_dir_get_parent(OsinfoDbImportDirCache *cache,
+                                const gchar *relpath,
+                                const gchar **name)
+{
+    g_autofree gchar *parent = NULL;
+    const gchar *tmp = strrchr(relpath, '/');
+
+    if (!tmp) {
+        *name = relpath;
+        return osinfo_db_import_dir_get(cache, "");
+    }
+
+    *name = tmp + 1;
+    parent = g_strndup(relpath, tmp - relpath);
+    return osinfo_db_import_dir_get(cache, parent);
+}
+
+/*
+ * Write sequentially for as long as the data is contiguous, which is
+ * always the case for the database, only falling back to pwrite()
+ * for the holes of sparse entries.
+ */
+static int osinfo_db_import_write_block(int fd,
+                                        const gchar *buf,
+                                        gsize size,
+                                        gint64 offset,
+                                        gint64 *pos)
+{
+    while (size > 0) {
+        ssize_t r;
+
+        if (offset == *pos)
+            r = write(fd, buf, size);
+        else
+            r = pwrite(fd, buf, size, offset);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (offset == *pos)
+            *pos += r;
+        buf += r;
+        size -= r;
+        offset += r;
+    }
+
+    return 0;
+}
+#endif /* !WIN32 */
+
+/*
+ * Write the file @relpath from @data if given, otherwise from the
+ * current entry of @arc. The content always goes into a new inode
+ * which is renamed over any existing file, so that hard links to
+ * the previous content, such as those used by --atomic, are left
+ * untouched.
+ */
+static int osinfo_db_import_write_file(OsinfoDbImport *import,
+                                       OsinfoDbImportTarget *target,
+                                       GFile *file,
+                                       const gchar *relpath,
                                        struct archive *arc,
-                                       struct archive_entry *entry)
+                                       struct archive_entry *entry,
+                                       GBytes *data)
 {
+#ifndef WIN32
+    OsinfoDbImportDir *dir;
+    g_autofree gchar *tmpname = NULL;
+    const gchar *name;
+    gint64 pos = 0;
+    gint64 size;
+    int fd = -1;
+    int ret = -1;
+    int r;
+
+    osinfo_db_import_throttle(import,
+                              data ? g_bytes_get_size(data) : archive_entry_size(entry));
+
+    if (!(dir = osinfo_db_import_dir_get_parent(target->dirs, relpath, &name)))
+        return -1;
+
+    tmpname = g_strdup_printf(".%s.%08x", name, g_random_int());
+    if ((fd = openat(dir->fd, tmpname,
+                     O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0) {
+        g_printerr("%s: cannot create %s/%s: %s\n",
+                   argv0, target->dirs->path, relpath, g_strerror(errno));
+        goto cleanup;
+    }
+
+    if (data) {
+        size = g_bytes_get_size(data);
+        if (osinfo_db_import_write_block(fd, g_bytes_get_data(data, NULL),
+                                         size, 0, &pos) < 0)
+            goto error;
+    } else {
+        size = archive_entry_size(entry);
+        for (;;) {
+            const void *buf;
+            size_t len;
+            gint64 offset;
+
+            r = archive_read_data_block(arc, &buf, &len, &offset);
+            if (r == ARCHIVE_EOF)
+                break;
+            if (r != ARCHIVE_OK) {
+                g_printerr("%s: cannot read data for %s: %s\n",
+                           argv0, relpath, archive_error_string(arc));
+                goto cleanup;
+            }
+            if (osinfo_db_import_write_block(fd, buf, len, offset, &pos) < 0)
+                goto error;
+        }
+    }
+
+    /* A sparse entry may end with a hole */
+    if (pos < size && ftruncate(fd, size) < 0)
+        goto error;
+
+    if (import->sync == OSINFO_DB_IMPORT_SYNC_FULL && fsync(fd) < 0)
+        goto error;
+
+    r = close(fd);
+    fd = -1;
+    if (r < 0 || renameat(dir->fd, tmpname, dir->fd, name) < 0)
+        goto error;
+
+    if (import->sync == OSINFO_DB_IMPORT_SYNC_FULL && fsync(dir->fd) < 0)
+        goto error;
+
+    ret = 0;
+    goto cleanup;
+
+ error:
+    g_printerr("%s: cannot write to %s/%s: %s\n",
+               argv0, target->dirs->path, relpath, g_strerror(errno));
+ cleanup:
+    if (fd >= 0)
+        close(fd);
+    if (ret < 0)
+        unlinkat(dir->fd, tmpname, 0);
+    osinfo_db_import_dir_put(target->dirs, dir);
+    return ret;
+#else /* WIN32 */
     g_autoptr(GFileOutputStream) os = NULL;
     g_autoptr(GError) err = NULL;
     int r;
@@ -54,6 +691,22 @@ static int osinfo_db_import_create_reg(GFile *file,
     size_t size;
     gint64 offset;
 
+    osinfo_db_import_throttle(import,
+                              data ? g_bytes_get_size(data) : archive_entry_size(entry));
+
+    if (data) {
+        if (!g_file_replace_contents(file,
+                                     g_bytes_get_data(data, NULL),
+                                     g_bytes_get_size(data),
+                                     NULL, FALSE,
+                                     G_FILE_CREATE_REPLACE_DESTINATION,
+                                     NULL, NULL, &err)) {
+            g_printerr("%s: %s\n", argv0, err->message);
+            return -1;
+        }
+        return 0;
+    }
+
     os = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION,
                         NULL, &err);
     if (!os) {
@@ -84,11 +737,36 @@ static int osinfo_db_import_create_reg(GFile *file,
         }
     }
     return 0;
+#endif /* WIN32 */
 }
 
-static int osinfo_db_import_create_dir(GFile *file,
-                                       struct archive_entry *entry)
+static int osinfo_db_import_write_dir(OsinfoDbImport *import,
+                                      OsinfoDbImportTarget *target,
+                                      GFile *file,
+                                      const gchar *relpath)
 {
+#ifndef WIN32
+    OsinfoDbImportDir *dir;
+    const gchar *name;
+    int ret = 0;
+
+    /* The top level directory is created with the cache */
+    if (!*relpath)
+        return 0;
+
+    if (!(dir = osinfo_db_import_dir_get_parent(target->dirs, relpath, &name)))
+        return -1;
+
+    if ((mkdirat(dir->fd, name, 0755) < 0 && errno != EEXIST) ||
+        (import->sync == OSINFO_DB_IMPORT_SYNC_FULL && fsync(dir->fd) < 0)) {
+        g_printerr("%s: cannot create directory %s/%s: %s\n",
+                   argv0, target->dirs->path, relpath, g_strerror(errno));
+        ret = -1;
+    }
+
+    osinfo_db_import_dir_put(target->dirs, dir);
+    return ret;
+#else /* WIN32 */
     g_autoptr(GError) err = NULL;
     if (!g_file_make_directory_with_parents(file, NULL, &err) &&
         err->code != G_IO_ERROR_EXISTS) {
@@ -96,357 +774,3346 @@ static int osinfo_db_import_create_dir(GFile *file,
         return -1;
     }
     return 0;
+#endif /* WIN32 */
 }
 
-
-static int osinfo_db_import_create(GFile *file,
-                                   struct archive *arc,
-                                   struct archive_entry *entry,
-                                   gboolean verbose)
+#ifndef WIN32
+/*
+ * A directory holding file content named after its SHA-256 digest,
+ * below a subdirectory named after the first two digits, so that
+ * identical files in several database locations, or in successive
+ * versions of the database, can all share the same inode.
+ */
+struct _OsinfoDbImportContentStore {
+    gchar *path;
+    int fd;
+    gboolean reflink;
+};
+
+static OsinfoDbImportContentStore *
+osinfo_db_import_content_store_new(const gchar *path, gboolean reflink)
 {
-    int type = archive_entry_filetype(entry) & AE_IFMT;
-
-    switch (type) {
-    case AE_IFREG:
-        if (verbose) {
-            g_print("%s: r %s\n", argv0, archive_entry_pathname(entry));
-        }
-        return osinfo_db_import_create_reg(file, arc, entry);
-
-    case AE_IFDIR:
-        if (verbose) {
-            g_print("%s: d %s\n", argv0, archive_entry_pathname(entry));
-        }
-        return osinfo_db_import_create_dir(file, entry);
-
-    default:
-        g_printerr("%s: unsupported file type for %s\n",
-                   argv0, archive_entry_pathname(entry));
-        return -1;
+    OsinfoDbImportContentStore *store;
+    int fd;
+
+    if (g_mkdir_with_parents(path, 0755) < 0 ||
+        (fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        g_printerr("%s: cannot open content store %s: %s\n",
+                   argv0, path, g_strerror(errno));
+        return NULL;
     }
+
+    store = g_new0(OsinfoDbImportContentStore, 1);
+    store->path = g_strdup(path);
+    store->fd = fd;
+    store->reflink = reflink;
+    return store;
 }
 
-static GFile *osinfo_db_import_get_file(GFile *target,
-                                        struct archive_entry *entry)
+static void
+osinfo_db_import_content_store_free(OsinfoDbImportContentStore *store)
 {
-    const gchar *entpath = archive_entry_pathname(entry);
-    const gchar *tmp = strchr(entpath, '/');
-    if (!tmp) {
-        tmp = "";
-    } else {
-        tmp++;
-    }
-    return g_file_resolve_relative_path(target, tmp);
+    if (!store)
+        return;
+    close(store->fd);
+    g_free(store->path);
+    g_free(store);
 }
 
-static gchar *
-osinfo_db_import_download_file(const gchar *source)
+/*
+ * Add @data to the store unless it is already there, and return the
+ * name of the object holding it relative to the store in @objname.
+ * Objects are read-only, as they are shared by every file linked to
+ * them.
+ */
+static int osinfo_db_import_content_add(OsinfoDbImport *import,
+                                        GBytes *data,
+                                        gchar **objname)
 {
-    g_autoptr(GInputStream) stream = NULL;
-    g_autoptr(GFile) out = NULL;
-    g_autoptr(GError) err = NULL;
-    g_autoptr(SoupMessage) message = NULL;
-    g_autofree gchar *filename = NULL;
-    g_autofree gchar *content = NULL;
-    gchar *source_file = NULL;
-    goffset content_size = 0;
-    GFileCreateFlags flags = G_FILE_CREATE_REPLACE_DESTINATION;
-    int ret = -1;
-
-    filename = g_path_get_basename(source);
-    if (filename == NULL)
-        goto cleanup;
-
-    source_file = g_build_filename(g_get_user_cache_dir(), filename, NULL);
-    if (source_file == NULL)
-        goto cleanup;
-
-    out = g_file_new_for_path(source_file);
-    if (out == NULL)
-        goto cleanup;
+    OsinfoDbImportContentStore *store = import->content;
+    g_autoptr(GChecksum) checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_autofree gchar *subdir = NULL;
+    g_autofree gchar *tmpname = NULL;
+    const gchar *digest;
+    gint64 pos = 0;
+    int fd;
+    int r;
 
-    if (session == NULL)
-        session = soup_session_new();
+    g_checksum_update(checksum, g_bytes_get_data(data, NULL),
+                      g_bytes_get_size(data));
+    digest = g_checksum_get_string(checksum);
+    subdir = g_strndup(digest, 2);
+    *objname = g_strdup_printf("%s/%s", subdir, digest + 2);
 
-    if (session == NULL)
-        goto cleanup;
+    /* Objects only appear once complete, so one found is usable */
+    if (faccessat(store->fd, *objname, F_OK, 0) == 0)
+        return 0;
 
-    message = soup_message_new("GET", source);
-    if (message == NULL)
-        goto cleanup;
+    osinfo_db_import_throttle(import, g_bytes_get_size(data));
 
-    stream = soup_session_send(session, message, NULL, &err);
-    if (stream == NULL ||
-        !SOUP_STATUS_IS_SUCCESSFUL(soup_message_get_status(message))) {
-        g_printerr("Could not access %s: %s\n",
-                   source,
-                   err != NULL ? err->message :
-                                 soup_status_get_phrase(soup_message_get_status(message)));
-        goto cleanup;
+    tmpname = g_strdup_printf("%s/.%s.%08x", subdir, digest + 2, g_random_int());
+    if (mkdirat(store->fd, subdir, 0755) == 0) {
+        if (import->sync == OSINFO_DB_IMPORT_SYNC_FULL && fsync(store->fd) < 0)
+            goto error;
+    } else if (errno != EEXIST) {
+        goto error;
     }
-
-    content_size = soup_message_headers_get_content_length(soup_message_get_response_headers(message));
-    content = g_malloc0(content_size);
-
-    if (!g_input_stream_read_all(stream, content, content_size, NULL, NULL, &err)) {
-        g_printerr("Could not load the content of %s: %s\n",
-                   source, err->message);
-        goto cleanup;
+    if ((fd = openat(store->fd, tmpname,
+                     O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444)) < 0)
+        goto error;
+
+    r = osinfo_db_import_write_block(fd, g_bytes_get_data(data, NULL),
+                                     g_bytes_get_size(data), 0, &pos);
+    if (r == 0 && import->sync == OSINFO_DB_IMPORT_SYNC_FULL)
+        r = fsync(fd);
+    if (close(fd) < 0)
+        r = -1;
+    if (r < 0 ||
+        renameat(store->fd, tmpname, store->fd, *objname) < 0) {
+        int saved = errno;
+        unlinkat(store->fd, tmpname, 0);
+        errno = saved;
+        goto error;
     }
 
-    if (!g_file_replace_contents(out, content, content_size, NULL, TRUE, flags, NULL, NULL, &err)) {
-        g_printerr("Could not download file \"%s\": %s\n",
-                   source, err->message);
-        goto cleanup;
+    /* Make the object itself durable before anything links to it */
+    if (import->sync == OSINFO_DB_IMPORT_SYNC_FULL) {
+        if ((fd = openat(store->fd, subdir,
+                         O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+            goto error;
+        if (fsync(fd) < 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            goto error;
+        }
+        close(fd);
     }
 
-    ret = 0;
-
- cleanup:
-    if (ret != 0 && source_file != NULL) {
-        unlink(source_file);
-        g_free(source_file);
-        source_file = NULL;
-    }
+    return 0;
 
-    return source_file;
+ error:
+    g_printerr("%s: cannot add %s to content store %s: %s\n",
+               argv0, *objname, store->path, g_strerror(errno));
+    g_clear_pointer(objname, g_free);
+    return -1;
 }
 
-static gboolean osinfo_db_get_installed_version(GFile *dir,
-                                                gchar **version)
+/*
+ * Install @relpath as a hard link to, or a reflink copy of, the store
+ * object holding @data. Returns 1 if neither is possible, e.g. when
+ * the store is on another filesystem, for the caller to write a
+ * plain copy instead.
+ */
+static int osinfo_db_import_content_link(OsinfoDbImport *import,
+                                         OsinfoDbImportTarget *target,
+                                         const gchar *relpath,
+                                         GBytes *data)
 {
-    g_autoptr(GFile) file = NULL;
-    g_autoptr(GError) err = NULL;
+    OsinfoDbImportContentStore *store = import->content;
+    g_autofree gchar *objname = NULL;
+    g_autofree gchar *tmpname = NULL;
+    OsinfoDbImportDir *dir;
+    const gchar *name;
+    struct stat objst;
+    struct stat st;
+    int ret = -1;
 
-    file = g_file_get_child(dir, VERSION_FILE);
-    if (file == NULL)
-        return FALSE;
+    if (osinfo_db_import_content_add(import, data, &objname) < 0)
+        return -1;
 
-    if (!g_file_load_contents(file, NULL, version, NULL, NULL, &err)) {
-        if (!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
-            g_printerr("Failed get the content of file %s: %s\n",
-                       VERSION_FILE, err->message);
-            return FALSE;
+    if (!(dir = osinfo_db_import_dir_get_parent(target->dirs, relpath, &name)))
+        return -1;
+
+    tmpname = g_strdup_printf(".%s.%08x", name, g_random_int());
+    if (store->reflink) {
+        int src = -1;
+        int fd = -1;
+        int r = -1;
+
+        if ((src = openat(store->fd, objname, O_RDONLY | O_CLOEXEC)) >= 0 &&
+            (fd = openat(dir->fd, tmpname,
+                         O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) >= 0) {
+#ifdef FICLONE
+            r = ioctl(fd, FICLONE, src);
+#else /* FICLONE */
+            errno = EOPNOTSUPP;
+#endif /* FICLONE */
+            /* Unlike a hard link, the clone is a new inode of its own */
+            if (r == 0 && import->sync == OSINFO_DB_IMPORT_SYNC_FULL &&
+                fsync(fd) < 0) {
+                int saved = errno;
+                close(src);
+                close(fd);
+                unlinkat(dir->fd, tmpname, 0);
+                errno = saved;
+                goto error;
+            }
+        }
+        if (src >= 0)
+            close(src);
+        if (fd >= 0)
+            close(fd);
+        if (r < 0) {
+            if (fd >= 0)
+                unlinkat(dir->fd, tmpname, 0);
+            ret = 1;
+            goto cleanup;
+        }
+    } else if (fstatat(store->fd, objname, &objst, 0) == 0 &&
+               fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+               objst.st_dev == st.st_dev && objst.st_ino == st.st_ino) {
+        /* Already linked, and rename() would leave tmpname behind */
+        ret = 0;
+        goto cleanup;
+    } else if (linkat(store->fd, objname, dir->fd, tmpname, 0) < 0) {
+        if (errno == EXDEV || errno == EMLINK || errno == EPERM) {
+            ret = 1;
+            goto cleanup;
         }
+        goto error;
     }
 
-    return TRUE;
+    if (renameat(dir->fd, tmpname, dir->fd, name) < 0) {
+        int saved = errno;
+        unlinkat(dir->fd, tmpname, 0);
+        errno = saved;
+        goto error;
+    }
+
+    if (import->sync == OSINFO_DB_IMPORT_SYNC_FULL && fsync(dir->fd) < 0)
+        goto error;
+
+    ret = 0;
+    goto cleanup;
+
+ error:
+    g_printerr("%s: cannot link %s/%s to content store: %s\n",
+               argv0, target->dirs->path, relpath, g_strerror(errno));
+ cleanup:
+    osinfo_db_import_dir_put(target->dirs, dir);
+    return ret;
 }
+#endif /* !WIN32 */
 
-static gboolean osinfo_db_get_info(const gchar *from_url,
-                                   gchar **version,
-                                   gchar **url)
+/*
+ * Install @data as @relpath, unless --skip-unchanged was given and
+ * the installed file already has this content.
+ */
+static int osinfo_db_import_store(OsinfoDbImport *import,
+                                  OsinfoDbImportTarget *target,
+                                  GFile *file,
+                                  const gchar *relpath,
+                                  GBytes *data)
+{
+    gboolean exists = TRUE;
+    int r = 1;
+
+    if (import->skip_unchanged &&
+        osinfo_db_import_is_unchanged(file, data, &exists)) {
+        g_atomic_int_inc(&import->nunchanged);
+        return 0;
+    }
+
+#ifndef WIN32
+    if (import->content &&
+        (r = osinfo_db_import_content_link(import, target, relpath, data)) < 0)
+        return -1;
+#endif /* !WIN32 */
+
+    if (r > 0 &&
+        osinfo_db_import_write_file(import, target, file, relpath,
+                                    NULL, NULL, data) < 0)
+        return -1;
+
+    if (exists)
+        g_atomic_int_inc(&import->nwritten);
+    else
+        g_atomic_int_inc(&import->nnew);
+    return 0;
+}
+
+
+/*
+ * Decompression is inherently sequential, but creating and writing
+ * the files is not, and on filesystems where each file has a high
+ * latency most of the time is spent there. The main thread reads
+ * each entry into memory and hands it to a pool of writer threads
+ * through a bounded queue. Directories are still created by the main
+ * thread, so they always exist before any file is queued inside them.
+ */
+#define OSINFO_DB_IMPORT_QUEUE_MAX 64
+
+typedef struct _OsinfoDbImportJob OsinfoDbImportJob;
+struct _OsinfoDbImportJob {
+    OsinfoDbImportTarget *target;
+    GFile *file;
+    gchar *relpath;
+    GBytes *data;
+};
+
+struct _OsinfoDbImportPool {
+    OsinfoDbImport *import;
+    GPtrArray *threads;
+    GMutex lock;
+    GCond cond;
+    GQueue jobs;
+    gboolean finished;
+    gboolean failed;
+};
+
+static void osinfo_db_import_job_free(OsinfoDbImportJob *job)
+{
+    g_object_unref(job->file);
+    g_free(job->relpath);
+    g_bytes_unref(job->data);
+    g_free(job);
+}
+
+static gpointer osinfo_db_import_pool_thread(gpointer opaque)
+{
+    OsinfoDbImportPool *pool = opaque;
+
+    g_mutex_lock(&pool->lock);
+    for (;;) {
+        OsinfoDbImportJob *job;
+        int r = 0;
+
+        while (g_queue_is_empty(&pool->jobs) && !pool->finished)
+            g_cond_wait(&pool->cond, &pool->lock);
+        if (!(job = g_queue_pop_head(&pool->jobs)))
+            break;
+        g_cond_broadcast(&pool->cond);
+
+        /* After an error, just drain the queue */
+        if (!pool->failed) {
+            g_mutex_unlock(&pool->lock);
+            r = osinfo_db_import_store(pool->import, job->target, job->file,
+                                       job->relpath, job->data);
+            g_mutex_lock(&pool->lock);
+        }
+        osinfo_db_import_job_free(job);
+
+        if (r < 0) {
+            pool->failed = TRUE;
+            g_cond_broadcast(&pool->cond);
+        }
+    }
+    g_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static OsinfoDbImportPool *
+osinfo_db_import_pool_new(OsinfoDbImport *import,
+                          guint nthreads)
+{
+    OsinfoDbImportPool *pool = g_new0(OsinfoDbImportPool, 1);
+    guint i;
+
+    pool->import = import;
+    pool->threads = g_ptr_array_new();
+    g_mutex_init(&pool->lock);
+    g_cond_init(&pool->cond);
+    g_queue_init(&pool->jobs);
+
+    for (i = 0; i < nthreads; i++)
+        g_ptr_array_add(pool->threads,
+                        g_thread_new("import", osinfo_db_import_pool_thread, pool));
+
+    return pool;
+}
+
+/*
+ * Hand a file over to the writer threads, blocking while the queue
+ * is full. Fails once any of the threads has hit an error.
+ */
+static int osinfo_db_import_pool_queue(OsinfoDbImportPool *pool,
+                                       OsinfoDbImportTarget *target,
+                                       GFile *file,
+                                       const gchar *relpath,
+                                       GBytes *data)
+{
+    OsinfoDbImportJob *job;
+    gboolean failed;
+
+    g_mutex_lock(&pool->lock);
+    while (pool->jobs.length >= OSINFO_DB_IMPORT_QUEUE_MAX && !pool->failed)
+        g_cond_wait(&pool->cond, &pool->lock);
+    failed = pool->failed;
+    if (!failed) {
+        job = g_new0(OsinfoDbImportJob, 1);
+        job->target = target;
+        job->file = g_object_ref(file);
+        job->relpath = g_strdup(relpath);
+        job->data = g_bytes_ref(data);
+        g_queue_push_tail(&pool->jobs, job);
+        g_cond_broadcast(&pool->cond);
+    }
+    g_mutex_unlock(&pool->lock);
+
+    return failed ? -1 : 0;
+}
+
+/*
+ * Wait for all queued files to be written and stop the threads.
+ * Returns -1 if any of them failed.
+ */
+static int osinfo_db_import_pool_finish(OsinfoDbImportPool *pool)
+{
+    int ret;
+    guint i;
+
+    g_mutex_lock(&pool->lock);
+    pool->finished = TRUE;
+    g_cond_broadcast(&pool->cond);
+    g_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->threads->len; i++)
+        g_thread_join(g_ptr_array_index(pool->threads, i));
+
+    ret = pool->failed ? -1 : 0;
+
+    g_ptr_array_free(pool->threads, TRUE);
+    g_mutex_clear(&pool->lock);
+    g_cond_clear(&pool->cond);
+    g_free(pool);
+
+    return ret;
+}
+
+
+/* Validate an XML file, or keep it for later if there is no schema yet */
+static int osinfo_db_import_validate(OsinfoDbImport *import,
+                                     const gchar *relpath,
+                                     GBytes *data)
 {
-    g_autoptr(SoupMessage) message = NULL;
-    g_autoptr(GInputStream) stream = NULL;
-    g_autoptr(JsonParser) parser = NULL;
-    g_autoptr(JsonReader) reader = NULL;
     g_autoptr(GError) err = NULL;
-    g_autofree gchar *content = NULL;
-    goffset content_size = 0;
 
-    if (session == NULL)
-        session = soup_session_new();
+    /* A black-out, not a document */
+    if (g_bytes_get_size(data) == 0)
+        return 0;
 
-    if (session == NULL)
-        return FALSE;
+    if (!import->schema) {
+        g_hash_table_replace(import->pending, g_strdup(relpath),
+                             g_bytes_ref(data));
+        return 0;
+    }
 
-    message = soup_message_new("GET", from_url);
-    if (message == NULL)
-        return FALSE;
+    if (!osinfo_db_schema_validate_data(import->schema, relpath,
+                                        g_bytes_get_data(data, NULL),
+                                        g_bytes_get_size(data), &err)) {
+        g_printerr("%s: %s\n", argv0, err->message);
+        return -1;
+    }
 
-    stream = soup_session_send(session, message, NULL, &err);
-    if (stream == NULL ||
-        !SOUP_STATUS_IS_SUCCESSFUL(soup_message_get_status(message))) {
-        g_printerr("Could not access %s: %s\n",
-                   from_url,
-                   err != NULL ? err->message :
-                                 soup_status_get_phrase(soup_message_get_status(message)));
-        return FALSE;
+    return 0;
+}
+
+/* Start validating against @schema, including the files seen so far */
+static int osinfo_db_import_set_schema(OsinfoDbImport *import,
+                                       OsinfoDbSchema *schema)
+{
+    GHashTableIter iter;
+    gpointer relpath;
+    gpointer data;
+
+    osinfo_db_schema_free(import->schema);
+    import->schema = schema;
+
+    g_hash_table_iter_init(&iter, import->pending);
+    while (g_hash_table_iter_next(&iter, &relpath, &data)) {
+        if (osinfo_db_import_validate(import, relpath, data) < 0)
+            return -1;
+        g_hash_table_iter_remove(&iter);
     }
 
-    content_size = soup_message_headers_get_content_length(soup_message_get_response_headers(message));
-    content = g_malloc0(content_size);
+    return 0;
+}
 
-    if (!g_input_stream_read_all(stream, content, content_size, NULL, NULL, &err)) {
-        g_printerr("Could not load the content of %s: %s\n",
-                   from_url, err->message);
-        return FALSE;
+/*
+ * The installed schema to fall back to when the archive has none.
+ * A database location overrides the ones below it, so the schema
+ * is searched in the location itself and then in those: a custom
+ * directory or the user location fall back to the local and then
+ * the system one, the local location to the system one. With
+ * several roots and directories, the first target which has a
+ * schema wins.
+ */
+static GFile *osinfo_db_import_find_schema(gchar **roots,
+                                           gchar **customs,
+                                           gboolean user,
+                                           gboolean local,
+                                           gboolean system)
+{
+    gsize i, j;
+
+    for (i = 0; i == 0 || (roots && roots[i]); i++) {
+        for (j = 0; j == 0 || (customs && customs[j]); j++) {
+            const gchar *custom = customs ? customs[j] : NULL;
+            GFile *file;
+
+            file = osinfo_db_get_file(roots ? roots[i] : "",
+                                      user || custom,
+                                      local || user || custom,
+                                      system || local || user || custom,
+                                      custom, SCHEMA_FILE, NULL);
+            if (file)
+                return file;
+        }
     }
 
-    parser = json_parser_new();
-    if (parser == NULL) {
-        g_printerr("Failed to create the json parser\n");
-        return FALSE;
+    return NULL;
+}
+
+static int osinfo_db_import_load_schema(OsinfoDbImport *import,
+                                        const gchar *relpath,
+                                        GBytes *data)
+{
+    g_autoptr(GError) err = NULL;
+    OsinfoDbSchema *schema;
+
+    if (!(schema = osinfo_db_schema_new_from_data(relpath,
+                                                  g_bytes_get_data(data, NULL),
+                                                  g_bytes_get_size(data),
+                                                  &err))) {
+        g_printerr("%s: %s\n", argv0, err->message);
+        return -1;
     }
 
-    if (!json_parser_load_from_data(parser, content, -1, &err)) {
-        g_printerr("Failed to parse the content of %s: %s\n",
-                   from_url, err->message);
-        return FALSE;
+    return osinfo_db_import_set_schema(import, schema);
+}
+
+/*
+ * Install the regular file @entry into every target. It is only
+ * decompressed once, and kept in memory when there is more than one
+ * target to write it to.
+ */
+static int osinfo_db_import_create_reg(OsinfoDbImport *import,
+                                       OsinfoDbImportTarget *targets,
+                                       guint ntargets,
+                                       const gchar *relpath,
+                                       struct archive *arc,
+                                       struct archive_entry *entry)
+{
+    g_autoptr(GBytes) data = NULL;
+    gboolean xml = import->validate && g_str_has_suffix(relpath, ".xml");
+    gboolean rng = import->validate && g_str_equal(relpath, SCHEMA_FILE);
+    guint i;
+
+    /* Nothing to check, compare or hand over, so stream it straight to disk */
+    if (ntargets == 1 && !import->skip_unchanged && !import->pool &&
+        !import->content && !xml && !rng) {
+        g_autoptr(GFile) file =
+            g_file_resolve_relative_path(osinfo_db_import_target_root(targets),
+                                         relpath);
+
+        return osinfo_db_import_write_file(import, targets, file, relpath,
+                                           arc, entry, NULL);
     }
 
-    reader = json_reader_new(json_parser_get_root(parser));
-    if (reader == NULL) {
-        g_printerr("Failed to create the reader for the json parser\n");
-        return FALSE;
+    if (!(data = osinfo_db_import_read_entry(arc, entry)))
+        return -1;
+
+    if (xml && osinfo_db_import_validate(import, relpath, data) < 0)
+        return -1;
+    if (rng && osinfo_db_import_load_schema(import, relpath, data) < 0)
+        return -1;
+
+    for (i = 0; i < ntargets; i++) {
+        g_autoptr(GFile) file =
+            g_file_resolve_relative_path(osinfo_db_import_target_root(&targets[i]),
+                                         relpath);
+        int r;
+
+        if (import->pool)
+            r = osinfo_db_import_pool_queue(import->pool, &targets[i], file,
+                                            relpath, data);
+        else
+            r = osinfo_db_import_store(import, &targets[i], file,
+                                       relpath, data);
+        if (r < 0)
+            return -1;
     }
 
-    if (!json_reader_read_member(reader, "release")) {
-        const GError *error = json_reader_get_error(reader);
-        g_printerr("Failed to read the \"release\" member of the %s file: %s\n",
-                   from_url, error->message);
-        return FALSE;
+    return 0;
+}
+
+
+static int osinfo_db_import_create_dir(OsinfoDbImport *import,
+                                       OsinfoDbImportTarget *targets,
+                                       guint ntargets,
+                                       const gchar *relpath)
+{
+    guint i;
+
+    for (i = 0; i < ntargets; i++) {
+        g_autoptr(GFile) file =
+            g_file_resolve_relative_path(osinfo_db_import_target_root(&targets[i]),
+                                         relpath);
+
+        if (osinfo_db_import_write_dir(import, &targets[i], file, relpath) < 0)
+            return -1;
     }
 
-    if (version && !json_reader_read_member(reader, "version")) {
-        const GError *error = json_reader_get_error(reader);
-        g_printerr("Failed to read the \"version\" member of the %s file: %s\n",
-                   from_url, error->message);
-        return FALSE;
+    return 0;
+}
+
+
+static int osinfo_db_import_create(OsinfoDbImport *import,
+                                   OsinfoDbImportTarget *targets,
+                                   guint ntargets,
+                                   const gchar *relpath,
+                                   struct archive *arc,
+                                   struct archive_entry *entry)
+{
+    int type = archive_entry_filetype(entry) & AE_IFMT;
+
+    switch (type) {
+    case AE_IFREG:
+        if (import->verbose) {
+            g_print("%s: r %s\n", argv0, archive_entry_pathname(entry));
+        }
+        return osinfo_db_import_create_reg(import, targets, ntargets,
+                                           relpath, arc, entry);
+
+    case AE_IFDIR:
+        if (import->verbose) {
+            g_print("%s: d %s\n", argv0, archive_entry_pathname(entry));
+        }
+        return osinfo_db_import_create_dir(import, targets, ntargets,
+                                           relpath);
+
+    default:
+        g_printerr("%s: unsupported file type for %s\n",
+                   argv0, archive_entry_pathname(entry));
+        return -1;
+    }
+}
+
+/* The path of @entry below the top level directory of the archive */
+static const gchar *osinfo_db_import_get_relpath(struct archive_entry *entry)
+{
+    const gchar *entpath = archive_entry_pathname(entry);
+    const gchar *tmp = strchr(entpath, '/');
+    if (!tmp) {
+        tmp = "";
+    } else {
+        tmp++;
+    }
+    return tmp;
+}
+
+/*
+ * Delete everything below @dir whose path relative to the top of
+ * the database was not seen in the archive, along with directories
+ * left empty as a result. @empty is set if nothing remains in @dir.
+ */
+static int osinfo_db_import_prune(OsinfoDbImport *import,
+                                  GFile *dir,
+                                  const gchar *relpath,
+                                  gboolean *empty)
+{
+    g_autoptr(GFileEnumerator) children = NULL;
+    g_autoptr(GError) err = NULL;
+    GFileInfo *info;
+
+    *empty = TRUE;
+    children = g_file_enumerate_children(dir,
+                                         G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                         G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                         G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                         NULL, &err);
+    if (!children) {
+        g_printerr("%s: %s\n", argv0, err->message);
+        return -1;
+    }
+
+    while ((info = g_file_enumerator_next_file(children, NULL, &err)) != NULL) {
+        const gchar *name = g_file_info_get_name(info);
+        g_autoptr(GFile) child = g_file_get_child(dir, name);
+        g_autofree gchar *childrel = NULL;
+        gboolean prunable = TRUE;
+
+        if (relpath)
+            childrel = g_strdup_printf("%s/%s", relpath, name);
+        else
+            childrel = g_strdup(name);
+
+        if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY &&
+            osinfo_db_import_prune(import, child, childrel, &prunable) < 0) {
+            g_object_unref(info);
+            return -1;
+        }
+        g_object_unref(info);
+
+        if (!prunable ||
+            g_hash_table_contains(import->seen, childrel)) {
+            *empty = FALSE;
+            continue;
+        }
+
+        if (!g_file_delete(child, NULL, &err)) {
+            g_printerr("%s: %s\n", argv0, err->message);
+            return -1;
+        }
+        g_print("%s: removed %s\n", argv0, childrel);
+        import->npruned++;
+    }
+
+    if (err) {
+        g_printerr("%s: %s\n", argv0, err->message);
+        return -1;
+    }
+
+    return 0;
+}
+
+static gchar *osinfo_db_import_get_cache_path(const gchar *name)
+{
+    return g_build_filename(g_get_user_cache_dir(), "osinfo-db-tools", name, NULL);
+}
+
+static gboolean osinfo_db_import_is_sha256(const gchar *checksum)
+{
+    gsize i;
+
+    for (i = 0; checksum[i]; i++) {
+        if (!g_ascii_isxdigit(checksum[i]))
+            return FALSE;
+    }
+
+    return i == 64;
+}
+
+/*
+ * Downloaded archives are kept under their SHA-256 digest, along
+ * with an index entry per URL recording the digest and validator of
+ * the last download from it. Importing the same archive again, into
+ * another location, for another user or after a failure, then costs
+ * at most a conditional request, and nothing at all when the digest
+ * is known beforehand. Once the archives take more than @maxsize
+ * bytes, the least recently used ones are evicted.
+ *
+ * A shared cache is used by several users, so its directory is
+ * group writable, and concurrent downloads of the same URL are
+ * serialized with a lock, so that only the first one hits the
+ * network and the others then find the archive in the cache. The
+ * archives themselves are read-only, and as any user of the cache
+ * could still replace them, they are checked against the digest
+ * they are named after as they are extracted, like a download, and
+ * the import is staged so that a mismatch leaves nothing behind.
+ */
+struct _OsinfoDbImportArchiveCache {
+    gchar *path;
+    goffset maxsize;
+    gboolean shared;
+};
+
+static OsinfoDbImportArchiveCache *
+osinfo_db_import_archive_cache_new(const gchar *path,
+                                   goffset maxsize,
+                                   gboolean shared)
+{
+    OsinfoDbImportArchiveCache *cache;
+
+    if (g_mkdir_with_parents(path, shared ? 0775 : 0700) < 0) {
+        g_printerr("%s: cannot create archive cache %s: %s\n",
+                   argv0, path, g_strerror(errno));
+        return NULL;
+    }
+
+    cache = g_new0(OsinfoDbImportArchiveCache, 1);
+    cache->path = g_strdup(path);
+    cache->maxsize = maxsize;
+    cache->shared = shared;
+
+    return cache;
+}
+
+static void
+osinfo_db_import_archive_cache_free(OsinfoDbImportArchiveCache *cache)
+{
+    if (!cache)
+        return;
+
+    g_free(cache->path);
+    g_free(cache);
+}
+
+typedef struct _OsinfoDbImportCachedArchive OsinfoDbImportCachedArchive;
+struct _OsinfoDbImportCachedArchive {
+    gchar *path;
+    gint64 used;
+    goffset size;
+};
+
+static gint osinfo_db_import_cached_archive_compare(gconstpointer a,
+                                                    gconstpointer b)
+{
+    const OsinfoDbImportCachedArchive *x = a;
+    const OsinfoDbImportCachedArchive *y = b;
+
+    return x->used < y->used ? -1 : x->used > y->used;
+}
+
+/*
+ * Remove the least recently used archives until the cache fits in
+ * its size, @keep going last, and then the index entries left
+ * pointing to archives which are gone. Archives are touched when
+ * they are used, so their modification time tells which ones were
+ * used last. Failures are ignored, as an archive may be removed by
+ * a concurrent import sharing the cache.
+ */
+static void
+osinfo_db_import_archive_cache_evict(OsinfoDbImportArchiveCache *cache,
+                                     const gchar *keep)
+{
+    g_autoptr(GDir) dir = NULL;
+    g_autoptr(GArray) archives = NULL;
+    g_autoptr(GPtrArray) indexes = NULL;
+    const gchar *name;
+    goffset total = 0;
+    guint i;
+
+    if (!(dir = g_dir_open(cache->path, 0, NULL)))
+        return;
+
+    archives = g_array_new(FALSE, FALSE, sizeof(OsinfoDbImportCachedArchive));
+    indexes = g_ptr_array_new_with_free_func(g_free);
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        OsinfoDbImportCachedArchive archive;
+        GStatBuf st;
+
+        if (g_str_has_suffix(name, ".index")) {
+            g_ptr_array_add(indexes, g_build_filename(cache->path, name, NULL));
+            continue;
+        }
+        if (!osinfo_db_import_is_sha256(name))
+            continue;
+
+        archive.path = g_build_filename(cache->path, name, NULL);
+        if (g_stat(archive.path, &st) < 0) {
+            g_free(archive.path);
+            continue;
+        }
+        archive.used = keep && g_str_equal(name, keep) ? G_MAXINT64 : st.st_mtime;
+        archive.size = st.st_size;
+        total += archive.size;
+        g_array_append_val(archives, archive);
+    }
+
+    g_array_sort(archives, osinfo_db_import_cached_archive_compare);
+    for (i = 0; i < archives->len; i++) {
+        OsinfoDbImportCachedArchive *archive =
+            &g_array_index(archives, OsinfoDbImportCachedArchive, i);
+
+        if (total > cache->maxsize && g_unlink(archive->path) == 0)
+            total -= archive->size;
+        g_free(archive->path);
+    }
+
+    for (i = 0; i < indexes->len; i++) {
+        const gchar *indexpath = g_ptr_array_index(indexes, i);
+        g_autoptr(GKeyFile) index = g_key_file_new();
+        g_autofree gchar *digest = NULL;
+        g_autofree gchar *path = NULL;
+
+        if (g_key_file_load_from_file(index, indexpath, G_KEY_FILE_NONE, NULL) &&
+            (digest = g_key_file_get_string(index, OSINFO_DB_IMPORT_INDEX_GROUP,
+                                            "sha256", NULL)) &&
+            osinfo_db_import_is_sha256(digest)) {
+            path = g_build_filename(cache->path, digest, NULL);
+            if (g_file_test(path, G_FILE_TEST_EXISTS))
+                continue;
+        }
+        g_unlink(indexpath);
+    }
+}
+
+#ifndef WIN32
+/*
+ * Wait for any other import downloading from the URL hashed as @key
+ * to be done. Returns the file descriptor holding the lock, or -1 if
+ * it cannot be taken, in which case the download goes ahead anyway.
+ */
+static int
+osinfo_db_import_archive_cache_lock(OsinfoDbImportArchiveCache *cache,
+                                    const gchar *key)
+{
+    g_autofree gchar *name = g_strdup_printf("%s.lock", key);
+    g_autofree gchar *path = g_build_filename(cache->path, name, NULL);
+    int fd;
+    int r;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC,
+                   cache->shared ? 0664 : 0600)) < 0)
+        return -1;
+
+    do {
+        r = flock(fd, LOCK_EX);
+    } while (r < 0 && errno == EINTR);
+
+    if (r < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+#endif /* !WIN32 */
+
+#define OSINFO_DB_IMPORT_BUFSIZE (64 * 1024)
+#define OSINFO_DB_IMPORT_RETRIES 3
+
+#define OSINFO_DB_IMPORT_PARTIAL_GROUP "download"
+
+/*
+ * An HTTP response being fed to libarchive as it arrives, so that
+ * the download, decompression and extraction all overlap without
+ * the archive ever being held in memory.
+ *
+ * If the server provides a validator (ETag or Last-Modified), the
+ * data is also copied to a partial file in the cache directory. A
+ * connection lost part way through is resumed with a Range request,
+ * and a later run of the tool whose previous download failed first
+ * replays the partial file, and then only fetches the remainder. The
+ * If-Range header ensures a modified archive is never stitched onto
+ * an old prefix.
+ *
+ * With an archive cache, the copy is made even without a validator,
+ * and moved into the cache once the archive has been imported.
+ */
+typedef struct _OsinfoDbImportDownload OsinfoDbImportDownload;
+struct _OsinfoDbImportDownload {
+    gchar *uri;
+    SoupMessage *message;
+    GInputStream *stream;
+    gchar *buf;
+
+    /* Bytes handed to libarchive so far, and expected in total */
+    goffset offset;
+    goffset total;
+
+    gchar *validator;
+    GFile *part;
+    gchar *metapath;
+    GInputStream *partin;
+    GOutputStream *partout;
+
+    /* Digest of everything handed to libarchive */
+    GChecksum *checksum;
+
+    /*
+     * The archive cache, the index entry for the URL, the archive
+     * previously downloaded from it, which only needs to be
+     * revalidated, and when it is still current, the file it is to be
+     * read from instead.
+     */
+    OsinfoDbImportArchiveCache *cache;
+    gchar *indexpath;
+    gchar *cached;
+    int cachefd;
+    int lockfd;
+
+    /* Fully read and verified, so the copy can go to the cache */
+    gboolean complete;
+};
+
+static void
+osinfo_db_import_download_free(OsinfoDbImportDownload *download)
+{
+    if (!download)
+        return;
+
+    if (download->stream)
+        g_object_unref(download->stream);
+    if (download->message)
+        g_object_unref(download->message);
+    if (download->partin)
+        g_object_unref(download->partin);
+    if (download->partout)
+        g_object_unref(download->partout);
+    if (download->part)
+        g_object_unref(download->part);
+    if (download->checksum)
+        g_checksum_free(download->checksum);
+    if (download->cachefd >= 0)
+        close(download->cachefd);
+    /* Not needed any more, whether it made it to the cache or not */
+    if (download->complete)
+        g_file_delete(download->part, NULL, NULL);
+#ifndef WIN32
+    /* Let other imports of the same URL go ahead */
+    if (download->lockfd >= 0)
+        close(download->lockfd);
+#endif /* !WIN32 */
+    g_free(download->uri);
+    g_free(download->buf);
+    g_free(download->validator);
+    g_free(download->metapath);
+    g_free(download->indexpath);
+    g_free(download->cached);
+    g_free(download);
+}
+
+/*
+ * Open the cached archive at @path, marking it as recently used. Its
+ * content is only checked against the digest it is named after while
+ * it is read, as it could be replaced in between otherwise.
+ */
+static int
+osinfo_db_import_archive_cache_open(const gchar *path)
+{
+    int fd;
+
+    if ((fd = g_open(path, O_RDONLY | O_BINARY, 0)) < 0)
+        return -1;
+
+    g_utime(path, NULL);
+    return fd;
+}
+
+/*
+ * Look for the archive in the cache. Returns a file descriptor on
+ * the archive with digest @checksum if it is cached, whose path is
+ * then in @download->cached, or else -1, with @download set up to
+ * revalidate the archive last downloaded from its URL, if it is
+ * still cached.
+ */
+static int
+osinfo_db_import_archive_cache_lookup(OsinfoDbImportDownload *download,
+                                      const gchar *checksum)
+{
+    OsinfoDbImportArchiveCache *cache = download->cache;
+    g_autoptr(GKeyFile) index = g_key_file_new();
+    g_autofree gchar *url = NULL;
+    g_autofree gchar *digest = NULL;
+    g_autofree gchar *path = NULL;
+    int fd;
+
+    /* Known content, so there is no need to ask the server at all */
+    if (checksum) {
+        digest = g_ascii_strdown(checksum, -1);
+        path = g_build_filename(cache->path, digest, NULL);
+        if ((fd = osinfo_db_import_archive_cache_open(path)) >= 0) {
+            download->cached = g_strdup(path);
+            return fd;
+        }
+        g_clear_pointer(&digest, g_free);
+        g_clear_pointer(&path, g_free);
+    }
+
+    if (!g_key_file_load_from_file(index, download->indexpath,
+                                   G_KEY_FILE_NONE, NULL) ||
+        !(url = g_key_file_get_string(index, OSINFO_DB_IMPORT_INDEX_GROUP,
+                                      "url", NULL)) ||
+        !g_str_equal(url, download->uri) ||
+        !(digest = g_key_file_get_string(index, OSINFO_DB_IMPORT_INDEX_GROUP,
+                                         "sha256", NULL)) ||
+        !osinfo_db_import_is_sha256(digest))
+        return -1;
+
+    /* Without a validator there is no way to tell it is still current */
+    path = g_build_filename(cache->path, digest, NULL);
+    if (!g_file_test(path, G_FILE_TEST_EXISTS) ||
+        !(download->validator = g_key_file_get_string(index,
+                                                      OSINFO_DB_IMPORT_INDEX_GROUP,
+                                                      "validator", NULL)))
+        return -1;
+
+    download->cached = g_strdup(path);
+    return -1;
+}
+
+/*
+ * Move the complete copy of the archive, once imported, into the
+ * cache, and record it as the latest one downloaded from its URL.
+ * The cache is only an optimization, so failures are not fatal.
+ */
+static void
+osinfo_db_import_archive_cache_add(OsinfoDbImportDownload *download)
+{
+    OsinfoDbImportArchiveCache *cache = download->cache;
+    const gchar *digest = g_checksum_get_string(download->checksum);
+    g_autoptr(GKeyFile) index = g_key_file_new();
+    g_autoptr(GFile) tmpfile = NULL;
+    g_autoptr(GError) err = NULL;
+    g_autofree gchar *partpath = g_file_get_path(download->part);
+    g_autofree gchar *path = g_build_filename(cache->path, digest, NULL);
+    g_autofree gchar *tmppath = NULL;
+    g_autofree gchar *data = NULL;
+    gsize len;
+
+    /* The partial copy lives in the user cache, which may be elsewhere */
+    tmppath = g_strdup_printf("%s/.%s.%08x", cache->path, digest, g_random_int());
+    if (g_rename(partpath, tmppath) < 0) {
+        tmpfile = g_file_new_for_path(tmppath);
+        if (!g_file_copy(download->part, tmpfile, G_FILE_COPY_NONE,
+                         NULL, NULL, NULL, &err))
+            goto error;
+    }
+    if (g_chmod(tmppath, cache->shared ? 0444 : 0400) < 0 ||
+        g_rename(tmppath, path) < 0)
+        goto error;
+
+    g_key_file_set_string(index, OSINFO_DB_IMPORT_INDEX_GROUP, "url", download->uri);
+    g_key_file_set_string(index, OSINFO_DB_IMPORT_INDEX_GROUP, "sha256", digest);
+    g_key_file_set_int64(index, OSINFO_DB_IMPORT_INDEX_GROUP, "size", download->offset);
+    if (download->validator)
+        g_key_file_set_string(index, OSINFO_DB_IMPORT_INDEX_GROUP, "validator",
+                              download->validator);
+    data = g_key_file_to_data(index, &len, NULL);
+    if (!g_file_set_contents(download->indexpath, data, len, &err))
+        goto error;
+
+    osinfo_db_import_archive_cache_evict(cache, digest);
+    return;
+
+ error:
+    g_printerr("%s: cannot keep %s in the archive cache: %s\n",
+               argv0, download->uri, err ? err->message : g_strerror(errno));
+    g_unlink(tmppath);
+}
+
+/*
+ * Send a GET request for the archive, starting at @from if it is
+ * not 0. Returns the HTTP status, or -1 if no usable response was
+ * received, with the reason in @err.
+ */
+static int
+osinfo_db_import_download_send(OsinfoDbImportDownload *download,
+                               goffset from,
+                               GError **err)
+{
+    SoupMessageHeaders *headers;
+    goffset length;
+    guint status;
+
+    g_clear_object(&download->stream);
+    g_clear_object(&download->message);
+
+    if (!(download->message = soup_message_new("GET", download->uri))) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                    "Invalid URI");
+        return -1;
+    }
+
+    headers = soup_message_get_request_headers(download->message);
+    if (from > 0) {
+        g_autofree gchar *range = g_strdup_printf("bytes=%" G_GOFFSET_FORMAT "-", from);
+
+        soup_message_headers_replace(headers, "Range", range);
+        if (download->validator)
+            soup_message_headers_replace(headers, "If-Range", download->validator);
+    } else if (download->cached) {
+        /* Entity tags are quoted, dates are not */
+        soup_message_headers_replace(headers,
+                                     download->validator[0] == '"' ?
+                                     "If-None-Match" : "If-Modified-Since",
+                                     download->validator);
+    }
+
+    download->stream = soup_session_send(session, download->message, NULL, err);
+    if (!download->stream)
+        return -1;
+
+    status = soup_message_get_status(download->message);
+    if (status != SOUP_STATUS_OK && status != SOUP_STATUS_PARTIAL_CONTENT) {
+        /* Expected answers to a range or conditional request */
+        gboolean expected = status == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE ||
+            status == SOUP_STATUS_NOT_MODIFIED;
+
+        if (!expected)
+            g_set_error(err, G_IO_ERROR, G_IO_ERROR_FAILED,
+                        "%s", soup_status_get_phrase(status));
+        g_clear_object(&download->stream);
+        return expected ? (int)status : -1;
+    }
+
+    headers = soup_message_get_response_headers(download->message);
+    length = soup_message_headers_get_content_length(headers);
+    if (status == SOUP_STATUS_PARTIAL_CONTENT)
+        download->total = length > 0 ? from + length : -1;
+    else
+        download->total = length > 0 ? length : -1;
+
+    return status;
+}
+
+/* Like osinfo_db_import_download_send(), retrying with a backoff */
+static int
+osinfo_db_import_download_send_retry(OsinfoDbImportDownload *download,
+                                     goffset from,
+                                     GError **err)
+{
+    int status;
+    guint i;
+
+    for (i = 0; ; i++) {
+        g_autoptr(GError) tmp = NULL;
+
+        if ((status = osinfo_db_import_download_send(download, from, &tmp)) > 0)
+            return status;
+
+        /* No point in asking again for something which is not there */
+        if (i == OSINFO_DB_IMPORT_RETRIES ||
+            (download->message &&
+             SOUP_STATUS_IS_CLIENT_ERROR(soup_message_get_status(download->message)))) {
+            g_propagate_error(err, tmp);
+            tmp = NULL;
+            return -1;
+        }
+
+        g_printerr("%s: cannot access %s, retrying: %s\n",
+                   argv0, download->uri, tmp->message);
+        g_usleep(G_USEC_PER_SEC << i);
+    }
+}
+
+/* Start copying the response to the partial file, if it can be resumed */
+static void
+osinfo_db_import_download_keep(OsinfoDbImportDownload *download)
+{
+    SoupMessageHeaders *headers = soup_message_get_response_headers(download->message);
+    g_autoptr(GKeyFile) meta = g_key_file_new();
+    g_autofree gchar *cachedir = osinfo_db_import_get_cache_path(NULL);
+    g_autofree gchar *data = NULL;
+    const gchar *validator;
+    gsize len;
+
+    g_clear_pointer(&download->validator, g_free);
+    validator = soup_message_headers_get_one(headers, "ETag");
+    if (!validator)
+        validator = soup_message_headers_get_one(headers, "Last-Modified");
+    /* Weak ETags cannot be used with If-Range */
+    if (validator && !g_str_has_prefix(validator, "W/"))
+        download->validator = g_strdup(validator);
+
+    g_file_delete(download->part, NULL, NULL);
+    g_unlink(download->metapath);
+    if (!download->validator && !download->cache)
+        return;
+
+    if (g_mkdir_with_parents(cachedir, 0700) < 0)
+        return;
+
+    /* Without a validator the copy can be cached, but not resumed */
+    if (download->validator) {
+        g_key_file_set_string(meta, OSINFO_DB_IMPORT_PARTIAL_GROUP, "url", download->uri);
+        g_key_file_set_string(meta, OSINFO_DB_IMPORT_PARTIAL_GROUP, "validator",
+                              download->validator);
+        data = g_key_file_to_data(meta, &len, NULL);
+
+        if (!g_file_set_contents(download->metapath, data, len, NULL))
+            return;
+    }
+
+    download->partout = G_OUTPUT_STREAM(g_file_create(download->part,
+                                                      G_FILE_CREATE_PRIVATE,
+                                                      NULL, NULL));
+}
+
+static OsinfoDbImportDownload *
+osinfo_db_import_download_new(OsinfoDbImport *import,
+                              const gchar *source)
+{
+    OsinfoDbImportDownload *download = NULL;
+    g_autoptr(GChecksum) checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_autoptr(GKeyFile) meta = g_key_file_new();
+    g_autoptr(GFileInfo) info = NULL;
+    g_autoptr(GError) err = NULL;
+    g_autofree gchar *name = NULL;
+    g_autofree gchar *partpath = NULL;
+    g_autofree gchar *url = NULL;
+    goffset resume = 0;
+    int status;
+
+    if (session == NULL)
+        session = soup_session_new();
+
+    if (session == NULL)
+        return NULL;
+
+    download = g_new0(OsinfoDbImportDownload, 1);
+    download->uri = g_strdup(source);
+    download->total = -1;
+    download->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    download->cachefd = -1;
+    download->lockfd = -1;
+
+    g_checksum_update(checksum, (const guchar *)source, -1);
+    name = g_strdup_printf("%s.part", g_checksum_get_string(checksum));
+    partpath = osinfo_db_import_get_cache_path(name);
+    download->part = g_file_new_for_path(partpath);
+    g_free(name);
+    name = g_strdup_printf("%s.partial", g_checksum_get_string(checksum));
+    download->metapath = osinfo_db_import_get_cache_path(name);
+
+    if ((download->cache = import->archives)) {
+        g_free(name);
+        name = g_strdup_printf("%s.index", g_checksum_get_string(checksum));
+        download->indexpath = g_build_filename(download->cache->path, name, NULL);
+#ifndef WIN32
+        download->lockfd =
+            osinfo_db_import_archive_cache_lock(download->cache,
+                                                g_checksum_get_string(checksum));
+#endif /* !WIN32 */
+        if ((download->cachefd =
+             osinfo_db_import_archive_cache_lookup(download, import->checksum)) >= 0)
+            return download;
+    }
+
+    /* Left over from a previous run which did not complete? */
+    if (!download->cached &&
+        g_key_file_load_from_file(meta, download->metapath, G_KEY_FILE_NONE, NULL) &&
+        (url = g_key_file_get_string(meta, OSINFO_DB_IMPORT_PARTIAL_GROUP, "url", NULL)) &&
+        g_str_equal(url, source) &&
+        (info = g_file_query_info(download->part, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                  G_FILE_QUERY_INFO_NONE, NULL, NULL))) {
+        download->validator = g_key_file_get_string(meta, OSINFO_DB_IMPORT_PARTIAL_GROUP,
+                                                    "validator", NULL);
+        if (download->validator)
+            resume = g_file_info_get_size(info);
+    }
+
+    status = osinfo_db_import_download_send_retry(download, resume, &err);
+    if (status == SOUP_STATUS_NOT_MODIFIED) {
+        if ((download->cachefd =
+             osinfo_db_import_archive_cache_open(download->cached)) >= 0)
+            return download;
+
+        /* Evicted in the meantime by another import */
+        g_clear_pointer(&download->cached, g_free);
+        g_clear_pointer(&download->validator, g_free);
+        status = osinfo_db_import_download_send_retry(download, 0, &err);
+    }
+    g_clear_pointer(&download->cached, g_free);
+    if (status == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE) {
+        resume = 0;
+        status = osinfo_db_import_download_send_retry(download, 0, &err);
+    }
+    if (status != SOUP_STATUS_OK && status != SOUP_STATUS_PARTIAL_CONTENT) {
+        g_printerr("Could not access %s: %s\n",
+                   source, err ? err->message : soup_status_get_phrase(status));
+        goto error;
+    }
+
+    if (status == SOUP_STATUS_PARTIAL_CONTENT) {
+        download->partin = G_INPUT_STREAM(g_file_read(download->part, NULL, &err));
+        if (!download->partin) {
+            g_printerr("%s: %s\n", argv0, err->message);
+            goto error;
+        }
+        download->partout = G_OUTPUT_STREAM(g_file_append_to(download->part,
+                                                             G_FILE_CREATE_PRIVATE,
+                                                             NULL, NULL));
+    } else {
+        osinfo_db_import_download_keep(download);
+    }
+
+    download->buf = g_malloc(OSINFO_DB_IMPORT_BUFSIZE);
+
+    return download;
+
+ error:
+    osinfo_db_import_download_free(download);
+    return NULL;
+}
+
+/*
+ * Read the next chunk from the network, transparently resuming the
+ * download where it stopped if the connection fails.
+ */
+static gssize
+osinfo_db_import_download_fetch(OsinfoDbImportDownload *download,
+                                GError **err)
+{
+    g_autoptr(GError) last = NULL;
+    gssize len;
+    int status;
+    guint i;
+
+    for (i = 0; ; i++) {
+        if (download->stream) {
+            g_clear_error(&last);
+            len = g_input_stream_read(download->stream, download->buf,
+                                      OSINFO_DB_IMPORT_BUFSIZE, NULL, &last);
+            if (len > 0)
+                return len;
+            /* A clean end of stream, unless the body was cut short */
+            if (len == 0 &&
+                (download->total < 0 || download->offset >= download->total))
+                return 0;
+            if (len == 0)
+                g_set_error(&last, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                            "Connection closed early");
+        }
+
+        if (i == OSINFO_DB_IMPORT_RETRIES || !download->validator) {
+            g_propagate_error(err, last);
+            last = NULL;
+            return -1;
+        }
+
+        g_printerr("%s: download of %s interrupted at %" G_GOFFSET_FORMAT
+                   " bytes, resuming: %s\n",
+                   argv0, download->uri, download->offset, last->message);
+        g_usleep(G_USEC_PER_SEC << i);
+
+        g_clear_error(&last);
+        status = osinfo_db_import_download_send(download, download->offset, &last);
+        if (status > 0 && status != SOUP_STATUS_PARTIAL_CONTENT) {
+            g_set_error(err, G_IO_ERROR, G_IO_ERROR_FAILED,
+                        "Archive changed on the server during the download");
+            return -1;
+        }
+    }
+}
+
+/*
+ * Get the next chunk of the archive, first from the partial copy
+ * left over by a previous run, if any, and then from the network.
+ * Returns its length, 0 at the end of the archive, or -1 on error.
+ */
+static gssize
+osinfo_db_import_download_next(OsinfoDbImportDownload *download,
+                               const void **buf,
+                               GError **err)
+{
+    gssize len;
+
+    if (download->partin) {
+        len = g_input_stream_read(download->partin, download->buf,
+                                  OSINFO_DB_IMPORT_BUFSIZE, NULL, err);
+        if (len < 0)
+            return -1;
+        if (len > 0) {
+            g_checksum_update(download->checksum, (const guchar *)download->buf, len);
+            download->offset += len;
+            *buf = download->buf;
+            return len;
+        }
+        g_clear_object(&download->partin);
+    }
+
+    if ((len = osinfo_db_import_download_fetch(download, err)) < 0)
+        return -1;
+
+    /* The copy is only an optimization, so give up on it on error */
+    if (download->partout &&
+        !g_output_stream_write_all(download->partout, download->buf, len,
+                                   NULL, NULL, NULL))
+        g_clear_object(&download->partout);
+
+    g_checksum_update(download->checksum, (const guchar *)download->buf, len);
+    download->offset += len;
+    *buf = download->buf;
+    return len;
+}
+
+static la_ssize_t
+osinfo_db_import_download_read(struct archive *arc,
+                               void *opaque,
+                               const void **buf)
+{
+    OsinfoDbImportDownload *download = opaque;
+    g_autoptr(GError) err = NULL;
+    gssize len;
+
+    if ((len = osinfo_db_import_download_next(download, buf, &err)) < 0) {
+        archive_set_error(arc, EIO, "%s", err->message);
+        return -1;
+    }
+
+    return len;
+}
+
+/*
+ * The archive was fully read, so the partial copy is not needed any
+ * more to resume it. If it was also @verified, the copy is kept as
+ * @download->part for osinfo_db_import_archive_cache_add(), until
+ * @download is freed.
+ */
+static void
+osinfo_db_import_download_done(OsinfoDbImportDownload *download,
+                               gboolean verified)
+{
+    if (verified && download->cache && download->partout &&
+        g_output_stream_close(download->partout, NULL, NULL))
+        download->complete = TRUE;
+    else
+        g_file_delete(download->part, NULL, NULL);
+    g_clear_object(&download->partout);
+    g_unlink(download->metapath);
+}
+
+/*
+ * Make sure the archive at @url, with digest @import->checksum if
+ * known, is in the archive cache, downloading it if needed. Returns
+ * its digest, or NULL on error.
+ */
+static gchar *
+osinfo_db_import_archive_cache_fetch(OsinfoDbImport *import,
+                                     const gchar *url)
+{
+    OsinfoDbImportDownload *download;
+    g_autoptr(GError) err = NULL;
+    g_autofree gchar *path = NULL;
+    gchar *digest = NULL;
+    const void *buf;
+    gssize len;
+
+    if (!(download = osinfo_db_import_download_new(import, url)))
+        return NULL;
+
+    if (download->cachefd >= 0) {
+        digest = g_path_get_basename(download->cached);
+        goto cleanup;
+    }
+
+    while ((len = osinfo_db_import_download_next(download, &buf, &err)) > 0)
+        ;
+    if (len < 0) {
+        g_printerr("%s: cannot download %s: %s\n", argv0, url, err->message);
+        goto cleanup;
+    }
+
+    if (import->checksum &&
+        g_ascii_strcasecmp(g_checksum_get_string(download->checksum),
+                           import->checksum) != 0) {
+        g_printerr("%s: checksum mismatch for archive %s: expected %s, got %s\n",
+                   argv0, url, import->checksum,
+                   g_checksum_get_string(download->checksum));
+        osinfo_db_import_download_done(download, FALSE);
+        goto cleanup;
+    }
+
+    osinfo_db_import_download_done(download, TRUE);
+    if (download->complete)
+        osinfo_db_import_archive_cache_add(download);
+    path = g_build_filename(import->archives->path,
+                            g_checksum_get_string(download->checksum), NULL);
+    if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+        g_printerr("%s: cannot keep %s in the archive cache\n", argv0, url);
+        goto cleanup;
+    }
+    digest = g_strdup(g_checksum_get_string(download->checksum));
+
+ cleanup:
+    osinfo_db_import_download_free(download);
+    return digest;
+}
+
+/* Block size for local archives which cannot be mapped, e.g. pipes */
+#define OSINFO_DB_IMPORT_READSIZE (1024 * 1024)
+
+/*
+ * The archive being imported, either downloaded, mapped in memory
+ * or read from a local file descriptor. Every byte handed over to
+ * libarchive is counted and, when the expected digest is known,
+ * hashed on the way, so the archive never needs to be read twice.
+ */
+typedef struct _OsinfoDbImportSource OsinfoDbImportSource;
+struct _OsinfoDbImportSource {
+    OsinfoDbImportDownload *download;
+    /* The entry of the archive cache being read, until it is checked */
+    gchar *cached;
+    int fd;
+    gchar *buf;
+    void *map;
+    gsize maplen;
+    gboolean mapped;
+    GChecksum *checksum;
+    goffset size;
+};
+
+/*
+ * Prepare reading a local archive from @source->fd. Regular files
+ * are mapped and handed over to libarchive in one go, so there are
+ * no read() calls at all, with the kernel told to read ahead
+ * aggressively and drop pages behind. Anything else is read in
+ * large blocks.
+ */
+static void
+osinfo_db_import_source_open_fd(OsinfoDbImportSource *source)
+{
+#ifndef WIN32
+    struct stat st;
+
+    if (fstat(source->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > 0 && (guint64)st.st_size <= G_MAXSIZE) {
+        source->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                           source->fd, 0);
+        if (source->map != MAP_FAILED) {
+            source->maplen = st.st_size;
+            madvise(source->map, source->maplen, MADV_SEQUENTIAL);
+            return;
+        }
+        source->map = NULL;
+    }
+
+    /* Harmless on pipes, where it fails with ESPIPE */
+    posix_fadvise(source->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif /* !WIN32 */
+
+    source->buf = g_malloc(OSINFO_DB_IMPORT_READSIZE);
+}
+
+static void
+osinfo_db_import_source_close(OsinfoDbImportSource *source)
+{
+#ifndef WIN32
+    if (source->map)
+        munmap(source->map, source->maplen);
+#endif /* !WIN32 */
+    if (source->fd > STDIN_FILENO)
+        close(source->fd);
+    osinfo_db_import_download_free(source->download);
+    g_free(source->cached);
+    g_free(source->buf);
+    if (source->checksum)
+        g_checksum_free(source->checksum);
+}
+
+static la_ssize_t
+osinfo_db_import_source_read(struct archive *arc,
+                             void *opaque,
+                             const void **buf)
+{
+    OsinfoDbImportSource *source = opaque;
+    la_ssize_t len;
+
+    if (source->download) {
+        len = osinfo_db_import_download_read(arc, source->download, buf);
+    } else if (source->map) {
+        len = source->mapped ? 0 : source->maplen;
+        source->mapped = TRUE;
+        *buf = source->map;
+    } else {
+        do {
+            len = read(source->fd, source->buf, OSINFO_DB_IMPORT_READSIZE);
+        } while (len < 0 && errno == EINTR);
+
+        if (len < 0) {
+            archive_set_error(arc, errno, "%s", g_strerror(errno));
+            return -1;
+        }
+        *buf = source->buf;
+    }
+
+    if (len > 0) {
+        if (source->checksum)
+            g_checksum_update(source->checksum, *buf, len);
+        source->size += len;
+    }
+
+    return len;
+}
+
+/*
+ * libarchive stops reading once it has seen the end of the archive,
+ * which may be before the end of the data, e.g. with tar padding.
+ * Consume what is left so that the whole file is accounted for.
+ */
+static int
+osinfo_db_import_source_drain(struct archive *arc,
+                              OsinfoDbImportSource *source)
+{
+    const void *buf;
+    la_ssize_t len;
+
+    while ((len = osinfo_db_import_source_read(arc, source, &buf)) > 0)
+        ;
+
+    return len < 0 ? -1 : 0;
+}
+
+/*
+ * Compare what was read from the archive cache with the digest the
+ * entry is named after, and remove it from the cache on a mismatch.
+ */
+static int
+osinfo_db_import_source_check_cached(OsinfoDbImportSource *source)
+{
+    g_autofree gchar *digest = NULL;
+    g_autofree gchar *path = source->cached;
+
+    if (!path)
+        return 0;
+
+    source->cached = NULL;
+
+    digest = g_path_get_basename(path);
+    if (g_str_equal(g_checksum_get_string(source->checksum), digest))
+        return 0;
+
+    g_printerr("%s: removing corrupted archive %s from the cache\n",
+               argv0, path);
+    g_unlink(path);
+    return -1;
+}
+
+/* Compare what was read with the expected digest and size */
+static int
+osinfo_db_import_source_verify(OsinfoDbImport *import,
+                               OsinfoDbImportSource *source,
+                               const gchar *name)
+{
+    if (osinfo_db_import_source_check_cached(source) < 0)
+        return -1;
+
+    if (import->size >= 0 && source->size != import->size) {
+        g_printerr("%s: size mismatch for archive %s: expected %"
+                   G_GOFFSET_FORMAT " bytes, got %" G_GOFFSET_FORMAT "\n",
+                   argv0, name, import->size, source->size);
+        return -1;
+    }
+
+    if (source->checksum &&
+        g_ascii_strcasecmp(g_checksum_get_string(source->checksum),
+                           import->checksum) != 0) {
+        g_printerr("%s: checksum mismatch for archive %s: expected %s, got %s\n",
+                   argv0, name, import->checksum,
+                   g_checksum_get_string(source->checksum));
+        return -1;
+    }
+
+    return 0;
+}
+
+static gboolean osinfo_db_get_installed_version(GFile *dir,
+                                                gchar **version)
+{
+    g_autoptr(GFile) file = NULL;
+    g_autoptr(GError) err = NULL;
+
+    file = g_file_get_child(dir, VERSION_FILE);
+    if (file == NULL)
+        return FALSE;
+
+    if (!g_file_load_contents(file, NULL, version, NULL, NULL, &err)) {
+        if (!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+            g_printerr("Failed get the content of file %s: %s\n",
+                       VERSION_FILE, err->message);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * The validators of the metadata file last successfully imported
+ * into @dir from @from_url are remembered, so that later runs can
+ * make a conditional request and stop early if it has not changed.
+ */
+static gchar *osinfo_db_import_cache_path(const gchar *from_url,
+                                          GFile *dir)
+{
+    g_autoptr(GChecksum) checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_autofree gchar *dirpath = g_file_get_path(dir);
+    g_autofree gchar *name = NULL;
+
+    g_checksum_update(checksum, (const guchar *)from_url, -1);
+    g_checksum_update(checksum, (const guchar *)"\n", 1);
+    g_checksum_update(checksum, (const guchar *)dirpath, -1);
+    name = g_strdup_printf("%s.metadata", g_checksum_get_string(checksum));
+
+    return osinfo_db_import_get_cache_path(name);
+}
+
+/*
+ * The validators are only trusted as long as the database is still
+ * the one they were saved along with: after a rollback, or an older
+ * archive imported by hand, they would hide a pending update.
+ */
+static GKeyFile *osinfo_db_import_cache_load(const gchar *from_url,
+                                             GFile *dir)
+{
+    g_autofree gchar *path = osinfo_db_import_cache_path(from_url, dir);
+    g_autofree gchar *installed = NULL;
+    g_autofree gchar *saved = NULL;
+    GKeyFile *cache = g_key_file_new();
+
+    /* Nothing to compare against if the database has gone away */
+    if (!osinfo_db_get_installed_version(dir, &installed) || !installed)
+        return cache;
+
+    if (!g_key_file_load_from_file(cache, path, G_KEY_FILE_NONE, NULL))
+        return cache;
+
+    saved = g_key_file_get_string(cache, OSINFO_DB_IMPORT_CACHE_GROUP,
+                                  "version", NULL);
+    if (g_strcmp0(saved, installed) != 0) {
+        g_key_file_free(cache);
+        cache = g_key_file_new();
+    }
+
+    return cache;
+}
+
+static void osinfo_db_import_cache_save(const gchar *from_url,
+                                        GFile *dir,
+                                        GKeyFile *cache)
+{
+    g_autofree gchar *path = osinfo_db_import_cache_path(from_url, dir);
+    g_autofree gchar *cachedir = g_path_get_dirname(path);
+    g_autofree gchar *data = NULL;
+    g_autofree gchar *installed = NULL;
+    g_autoptr(GError) err = NULL;
+    gsize len;
+
+    /* Without a version to tie them to, the validators are useless */
+    if (!osinfo_db_get_installed_version(dir, &installed) || !installed) {
+        g_unlink(path);
+        return;
+    }
+
+    g_key_file_set_string(cache, OSINFO_DB_IMPORT_CACHE_GROUP, "url", from_url);
+    g_key_file_set_string(cache, OSINFO_DB_IMPORT_CACHE_GROUP, "version", installed);
+    data = g_key_file_to_data(cache, &len, NULL);
+
+    /* The cache is only an optimization, so failures are not fatal */
+    if (g_mkdir_with_parents(cachedir, 0700) < 0 ||
+        !g_file_set_contents(path, data, len, &err)) {
+        g_printerr("%s: cannot save metadata cache %s: %s\n",
+                   argv0, path, err ? err->message : g_strerror(errno));
+    }
+}
+
+static void osinfo_db_import_cache_header(GKeyFile *cache,
+                                          const gchar *key,
+                                          SoupMessageHeaders *headers,
+                                          const gchar *name)
+{
+    const gchar *value = soup_message_headers_get_one(headers, name);
+
+    if (value)
+        g_key_file_set_string(cache, OSINFO_DB_IMPORT_CACHE_GROUP, key, value);
+    else
+        g_key_file_remove_key(cache, OSINFO_DB_IMPORT_CACHE_GROUP, key, NULL);
+}
+
+/*
+ * Fetch the metadata file at @from_url. If @cache holds validators
+ * from a previous run, the request is made conditional and
+ * @unchanged is set when the server reports the file has not been
+ * modified since, in which case @version and @url are left unset.
+ * The optional "sha256" and "size" of the archive are returned in
+ * @checksum and @size, or NULL and -1 when they are not published,
+ * and the whole document in @root if it is not NULL.
+ */
+static gboolean osinfo_db_get_info(const gchar *from_url,
+                                   GKeyFile *cache,
+                                   gchar **version,
+                                   gchar **url,
+                                   gchar **checksum,
+                                   goffset *size,
+                                   gboolean *unchanged,
+                                   JsonNode **root)
+{
+    g_autoptr(SoupMessage) message = NULL;
+    g_autoptr(GInputStream) stream = NULL;
+    g_autoptr(JsonParser) parser = NULL;
+    g_autoptr(JsonReader) reader = NULL;
+    g_autoptr(GError) err = NULL;
+    g_autoptr(GByteArray) content = NULL;
+    g_autofree gchar *etag = NULL;
+    g_autofree gchar *modified = NULL;
+    guint8 buf[4096];
+    gssize len;
+
+    if (session == NULL)
+        session = soup_session_new();
+
+    if (session == NULL)
+        return FALSE;
+
+    message = soup_message_new("GET", from_url);
+    if (message == NULL)
+        return FALSE;
+
+    etag = g_key_file_get_string(cache, OSINFO_DB_IMPORT_CACHE_GROUP,
+                                 "etag", NULL);
+    modified = g_key_file_get_string(cache, OSINFO_DB_IMPORT_CACHE_GROUP,
+                                     "last-modified", NULL);
+    if (etag)
+        soup_message_headers_replace(soup_message_get_request_headers(message),
+                                     "If-None-Match", etag);
+    if (modified)
+        soup_message_headers_replace(soup_message_get_request_headers(message),
+                                     "If-Modified-Since", modified);
+
+    *unchanged = FALSE;
+    stream = soup_session_send(session, message, NULL, &err);
+    if (stream != NULL &&
+        soup_message_get_status(message) == SOUP_STATUS_NOT_MODIFIED) {
+        *unchanged = TRUE;
+        return TRUE;
+    }
+
+    if (stream == NULL ||
+        !SOUP_STATUS_IS_SUCCESSFUL(soup_message_get_status(message))) {
+        g_printerr("Could not access %s: %s\n",
+                   from_url,
+                   err != NULL ? err->message :
+                                 soup_status_get_phrase(soup_message_get_status(message)));
+        return FALSE;
+    }
+
+    osinfo_db_import_cache_header(cache, "etag",
+                                  soup_message_get_response_headers(message),
+                                  "ETag");
+    osinfo_db_import_cache_header(cache, "last-modified",
+                                  soup_message_get_response_headers(message),
+                                  "Last-Modified");
+
+    /* The length is not known up front with a chunked encoding */
+    content = g_byte_array_new();
+    while ((len = g_input_stream_read(stream, buf, sizeof(buf), NULL, &err)) > 0) {
+        if (content->len + len > OSINFO_DB_IMPORT_METADATA_MAX) {
+            g_printerr("Could not load the content of %s: larger than %d bytes\n",
+                       from_url, OSINFO_DB_IMPORT_METADATA_MAX);
+            return FALSE;
+        }
+        g_byte_array_append(content, buf, len);
+    }
+
+    if (len < 0) {
+        g_printerr("Could not load the content of %s: %s\n",
+                   from_url, err->message);
+        return FALSE;
+    }
+    g_byte_array_append(content, (const guint8 *)"", 1);
+
+    parser = json_parser_new();
+    if (parser == NULL) {
+        g_printerr("Failed to create the json parser\n");
+        return FALSE;
+    }
+
+    if (!json_parser_load_from_data(parser, (const gchar *)content->data, -1, &err)) {
+        g_printerr("Failed to parse the content of %s: %s\n",
+                   from_url, err->message);
+        return FALSE;
+    }
+
+    reader = json_reader_new(json_parser_get_root(parser));
+    if (reader == NULL) {
+        g_printerr("Failed to create the reader for the json parser\n");
+        return FALSE;
+    }
+
+    if (!json_reader_read_member(reader, "release")) {
+        const GError *error = json_reader_get_error(reader);
+        g_printerr("Failed to read the \"release\" member of the %s file: %s\n",
+                   from_url, error->message);
+        return FALSE;
+    }
+
+    if (version && !json_reader_read_member(reader, "version")) {
+        const GError *error = json_reader_get_error(reader);
+        g_printerr("Failed to read the \"version\" member of the %s file: %s\n",
+                   from_url, error->message);
+        return FALSE;
+    }
+
+    if (version) {
+        *version = g_strdup(json_reader_get_string_value(reader));
+        if (*version == NULL)
+            return FALSE;
+
+        json_reader_end_member(reader); /* "version" */
+    }
+
+    if (!json_reader_read_member(reader, "archive")) {
+        const GError *error = json_reader_get_error(reader);
+        g_printerr("Failed to read the \"archive\" member of the %s file: %s\n",
+                   from_url, error->message);
+        return FALSE;
+    }
+
+    *url = g_strdup(json_reader_get_string_value(reader));
+    if (*url == NULL)
+        return FALSE;
+
+    json_reader_end_member(reader); /* "archive" */
+
+    *checksum = NULL;
+    if (json_reader_read_member(reader, "sha256"))
+        *checksum = g_strdup(json_reader_get_string_value(reader));
+    json_reader_end_member(reader); /* "sha256" */
+
+    *size = -1;
+    if (json_reader_read_member(reader, "size"))
+        *size = json_reader_get_int_value(reader);
+    json_reader_end_member(reader); /* "size" */
+
+    json_reader_end_member(reader); /* "release" */
+
+    if (root)
+        *root = json_node_copy(json_parser_get_root(parser));
+
+    return TRUE;
+}
+
+static int osinfo_db_import_remove_tree(GFile *file)
+{
+    g_autoptr(GFileEnumerator) children = NULL;
+    g_autoptr(GError) err = NULL;
+    GFileInfo *info;
+
+    children = g_file_enumerate_children(file,
+                                         G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                         G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                         G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                         NULL, NULL);
+    while (children &&
+           (info = g_file_enumerator_next_file(children, NULL, NULL)) != NULL) {
+        g_autoptr(GFile) child = g_file_get_child(file, g_file_info_get_name(info));
+        int r = 0;
+
+        if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY)
+            r = osinfo_db_import_remove_tree(child);
+        else if (!g_file_delete(child, NULL, &err))
+            r = -1;
+        g_object_unref(info);
+
+        if (r < 0) {
+            if (err)
+                g_printerr("%s: %s\n", argv0, err->message);
+            return -1;
+        }
+    }
+
+    if (!g_file_delete(file, NULL, &err) &&
+        !g_error_matches(err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+        g_printerr("%s: %s\n", argv0, err->message);
+        return -1;
+    }
+    return 0;
+}
+
+#ifndef WIN32
+/*
+ * Populate the staging directory with hardlinks to the files already
+ * installed, so that the swap preserves anything the archive does not
+ * replace. Extracted files are always written to new inodes, so the
+ * live tree is never modified through these links.
+ */
+static int osinfo_db_import_link_tree(const gchar *src,
+                                      const gchar *dst)
+{
+    g_autoptr(GDir) dir = NULL;
+    g_autoptr(GError) err = NULL;
+    const gchar *name;
+
+    if (!(dir = g_dir_open(src, 0, &err))) {
+        g_printerr("%s: %s\n", argv0, err->message);
+        return -1;
+    }
+
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        g_autofree gchar *srcpath = g_build_filename(src, name, NULL);
+        g_autofree gchar *dstpath = g_build_filename(dst, name, NULL);
+        GStatBuf sb;
+
+        if (g_lstat(srcpath, &sb) < 0) {
+            g_printerr("%s: cannot stat %s: %s\n",
+                       argv0, srcpath, g_strerror(errno));
+            return -1;
+        }
+
+        if (S_ISDIR(sb.st_mode)) {
+            if (g_mkdir(dstpath, sb.st_mode & 07777) < 0) {
+                g_printerr("%s: cannot create directory %s: %s\n",
+                           argv0, dstpath, g_strerror(errno));
+                return -1;
+            }
+            if (osinfo_db_import_link_tree(srcpath, dstpath) < 0)
+                return -1;
+        } else if (link(srcpath, dstpath) < 0) {
+            g_printerr("%s: cannot link %s to %s: %s\n",
+                       argv0, srcpath, dstpath, g_strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Atomically exchange two paths if the kernel supports it. Returns
+ * -1 with errno set to ENOSYS or EINVAL if it does not.
+ */
+static int osinfo_db_import_exchange(const gchar *a,
+                                     const gchar *b)
+{
+# if defined(__linux__) && defined(SYS_renameat2)
+    return syscall(SYS_renameat2, AT_FDCWD, a, AT_FDCWD, b, RENAME_EXCHANGE);
+# else
+    errno = ENOSYS;
+    return -1;
+# endif
+}
+#endif /* !WIN32 */
+
+/*
+ * Create the staging directory for @target, seeded with the content
+ * of @seed, or of the live directory if NULL.
+ */
+static int osinfo_db_import_target_begin(OsinfoDbImportTarget *target,
+                                         const gchar *seed)
+{
+#ifndef WIN32
+    g_autofree gchar *parent = NULL;
+    g_autofree gchar *basename = NULL;
+
+    target->path = g_file_get_path(target->dir);
+    parent = g_path_get_dirname(target->path);
+    basename = g_path_get_basename(target->path);
+
+    if (g_mkdir_with_parents(parent, 0755) < 0) {
+        g_printerr("%s: cannot create directory %s: %s\n",
+                   argv0, parent, g_strerror(errno));
+        return -1;
+    }
+
+    /* Must be on the same filesystem as the target for the swap */
+    target->stagingpath = g_strdup_printf("%s/.%s.XXXXXX", parent, basename);
+    if (!g_mkdtemp_full(target->stagingpath, 0755)) {
+        g_printerr("%s: cannot create staging directory %s: %s\n",
+                   argv0, target->stagingpath, g_strerror(errno));
+        g_clear_pointer(&target->stagingpath, g_free);
+        return -1;
+    }
+    target->staging = g_file_new_for_path(target->stagingpath);
+
+    if (!seed)
+        seed = target->path;
+    if (g_file_test(seed, G_FILE_TEST_IS_DIR) &&
+        osinfo_db_import_link_tree(seed, target->stagingpath) < 0)
+        return -1;
+
+    return 0;
+#else /* WIN32 */
+    g_printerr("%s: atomic import is not supported on this platform\n",
+               argv0);
+    return -1;
+#endif /* WIN32 */
+}
+
+#ifndef WIN32
+/*
+ * Why the database in @target cannot be swapped with a staging
+ * directory, or NULL if it can as far as can be told beforehand.
+ */
+static const gchar *osinfo_db_import_target_cannot_stage(OsinfoDbImportTarget *target)
+{
+    g_autofree gchar *path = g_file_get_path(target->dir);
+    g_autofree gchar *parent = g_path_get_dirname(path);
+    GStatBuf sb;
+    GStatBuf parentsb;
+
+    /* Such as a bind mount into a container, which cannot be renamed */
+    if (g_stat(path, &sb) == 0 && g_stat(parent, &parentsb) == 0 &&
+        sb.st_dev != parentsb.st_dev)
+        return "it is a mount point";
+
+    if (access(parent, W_OK) < 0 && errno != ENOENT)
+        return "its parent directory is not writable";
+
+    return NULL;
+}
+#endif /* !WIN32 */
+
+/* Discard the staging directory, leaving the live database untouched */
+static int osinfo_db_import_target_abort(OsinfoDbImportTarget *target)
+{
+    int ret = 0;
+
+    if (target->staging &&
+        osinfo_db_import_remove_tree(target->staging) < 0)
+        ret = -1;
+    g_clear_object(&target->staging);
+
+    return ret;
+}
+
+static void osinfo_db_import_target_clear(OsinfoDbImportTarget *target)
+{
+    g_clear_object(&target->dir);
+    g_clear_object(&target->staging);
+    g_free(target->path);
+    g_free(target->stagingpath);
+}
+
+/*
+ * @dir with any symbolic link resolved, as far as it exists. The
+ * rest of the path is taken as is, as it is yet to be created.
+ */
+static GFile *osinfo_db_import_canonical_dir(GFile *dir)
+{
+#ifndef WIN32
+    g_autofree gchar *path = g_file_get_path(dir);
+    g_autofree gchar *basename = NULL;
+    g_autoptr(GFile) parent = NULL;
+    g_autoptr(GFile) realparent = NULL;
+    char *real;
+
+    if ((real = realpath(path, NULL)) != NULL) {
+        GFile *ret = g_file_new_for_path(real);
+        free(real);
+        return ret;
+    }
+    if (errno == ENOENT && (parent = g_file_get_parent(dir)) != NULL) {
+        basename = g_file_get_basename(dir);
+        realparent = osinfo_db_import_canonical_dir(parent);
+        return g_file_get_child(realparent, basename);
+    }
+#endif /* !WIN32 */
+
+    return g_object_ref(dir);
+}
+
+/*
+ * Whether importing into both @a and @b would have one of them
+ * write into, or with --prune delete, the content of the other.
+ */
+static gboolean osinfo_db_import_target_overlaps(GFile *a,
+                                                 GFile *b)
+{
+    g_autoptr(GFile) reala = osinfo_db_import_canonical_dir(a);
+    g_autoptr(GFile) realb = osinfo_db_import_canonical_dir(b);
+
+    return g_file_equal(reala, realb) ||
+        g_file_has_prefix(reala, realb) ||
+        g_file_has_prefix(realb, reala);
+}
+
+#ifndef WIN32
+/*
+ * Move the directory @from to @to, and whatever @to held out of the
+ * way. The path the previous content of @to ended up at is returned
+ * in @previous, or NULL if @to did not exist.
+ */
+static int osinfo_db_import_swap(const gchar *from,
+                                 const gchar *to,
+                                 gchar **previous)
+{
+    g_autofree gchar *oldpath = NULL;
+
+    *previous = NULL;
+
+    if (!g_file_test(to, G_FILE_TEST_EXISTS)) {
+        if (g_rename(from, to) < 0) {
+            g_printerr("%s: cannot rename %s to %s: %s\n",
+                       argv0, from, to, g_strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    if (osinfo_db_import_exchange(from, to) == 0) {
+        *previous = g_strdup(from);
+        return 0;
+    }
+    if (errno != ENOSYS && errno != EINVAL) {
+        g_printerr("%s: cannot exchange %s with %s: %s\n",
+                   argv0, from, to, g_strerror(errno));
+        return -1;
+    }
+
+    /*
+     * Without an atomic exchange, there is a short window where
+     * the live directory does not exist at all, but never one
+     * where it holds a mix of old and new files.
+     */
+    oldpath = g_strdup_printf("%s.old", from);
+    if (g_rename(to, oldpath) < 0) {
+        g_printerr("%s: cannot rename %s to %s: %s\n",
+                   argv0, to, oldpath, g_strerror(errno));
+        return -1;
+    }
+    if (g_rename(from, to) < 0) {
+        g_printerr("%s: cannot rename %s to %s: %s\n",
+                   argv0, from, to, g_strerror(errno));
+        g_rename(oldpath, to);
+        return -1;
+    }
+
+    *previous = oldpath;
+    oldpath = NULL;
+    return 0;
+}
+#endif /* !WIN32 */
+
+/*
+ * Swap the staging directory of @target in place of the live one.
+ * The previous database is kept aside, so that the swap can still
+ * be reverted, until osinfo_db_import_target_finish() is called.
+ */
+static int osinfo_db_import_target_commit(OsinfoDbImportTarget *target,
+                                          gboolean durable)
+{
+#ifndef WIN32
+    g_autofree gchar *parent = NULL;
+    gchar *previous;
+
+    if (!target->staging)
+        return 0;
+
+    if (osinfo_db_import_swap(target->stagingpath, target->path,
+                              &previous) < 0)
+        return -1;
+    g_clear_object(&target->staging);
+    if (previous) {
+        target->staging = g_file_new_for_path(previous);
+        g_free(previous);
+    }
+    target->committed = TRUE;
+
+    parent = g_path_get_dirname(target->path);
+    if (durable && osinfo_db_import_fsync_path(parent) < 0)
+        return -1;
+#endif /* !WIN32 */
+
+    return 0;
+}
+
+/*
+ * Put the previous database of @target back in place, after some
+ * other target failed to commit. The new database is left in the
+ * staging directory, for osinfo_db_import_target_abort().
+ */
+static int osinfo_db_import_target_revert(OsinfoDbImportTarget *target,
+                                          gboolean durable)
+{
+#ifndef WIN32
+    g_autofree gchar *parent = NULL;
+    g_autofree gchar *prevpath = NULL;
+    gchar *discarded = NULL;
+
+    if (!target->committed)
+        return 0;
+
+    if (target->staging) {
+        prevpath = g_file_get_path(target->staging);
+        if (osinfo_db_import_swap(prevpath, target->path, &discarded) < 0)
+            return -1;
+    } else {
+        if (g_rename(target->path, target->stagingpath) < 0) {
+            g_printerr("%s: cannot rename %s to %s: %s\n",
+                       argv0, target->path, target->stagingpath,
+                       g_strerror(errno));
+            return -1;
+        }
+        discarded = g_strdup(target->stagingpath);
+    }
+    g_clear_object(&target->staging);
+    target->staging = g_file_new_for_path(discarded);
+    g_free(discarded);
+    target->committed = FALSE;
+
+    parent = g_path_get_dirname(target->path);
+    if (durable && osinfo_db_import_fsync_path(parent) < 0)
+        return -1;
+#endif /* !WIN32 */
+
+    return 0;
+}
+
+/* Drop the previous database of a committed @target */
+static int osinfo_db_import_target_finish(OsinfoDbImportTarget *target)
+{
+    target->committed = FALSE;
+
+    /* The staging path now holds the previous database, if any */
+    return osinfo_db_import_target_abort(target);
+}
+
+#ifndef WIN32
+/* Snapshots of @target are kept in a hidden directory next to it */
+static gchar *osinfo_db_import_snapshot_dir(OsinfoDbImportTarget *target)
+{
+    g_autofree gchar *path = g_file_get_path(target->dir);
+    g_autofree gchar *parent = g_path_get_dirname(path);
+    g_autofree gchar *basename = g_path_get_basename(path);
+
+    return g_strdup_printf("%s/.%s.snapshots", parent, basename);
+}
+
+/*
+ * The version of the database in @path, which names its snapshot,
+ * or NULL if it has none usable as a file name.
+ */
+static gchar *osinfo_db_import_snapshot_version(const gchar *path)
+{
+    g_autofree gchar *file = g_build_filename(path, VERSION_FILE, NULL);
+    gchar *version = NULL;
+
+    if (!g_file_get_contents(file, &version, NULL, NULL))
+        return NULL;
+
+    g_strstrip(version);
+    if (!*version || *version == '.' || strchr(version, '/')) {
+        g_free(version);
+        return NULL;
+    }
+
+    return version;
+}
+
+static gint osinfo_db_import_snapshot_compare(gconstpointer a,
+                                              gconstpointer b)
+{
+    return g_strcmp0(*(const gchar **)a, *(const gchar **)b);
+}
+
+/* The versions of the snapshots in @snapdir, oldest first */
+static GPtrArray *osinfo_db_import_snapshot_list(const gchar *snapdir)
+{
+    GPtrArray *versions = g_ptr_array_new_with_free_func(g_free);
+    g_autoptr(GDir) dir = g_dir_open(snapdir, 0, NULL);
+    const gchar *name;
+
+    /* Ignore snapshots being created */
+    while (dir && (name = g_dir_read_name(dir)) != NULL) {
+        if (*name != '.')
+            g_ptr_array_add(versions, g_strdup(name));
+    }
+    g_ptr_array_sort(versions, osinfo_db_import_snapshot_compare);
+
+    return versions;
+}
+
+/*
+ * Record the database installed in @target as a snapshot named after
+ * its version, made of hard links to its files. As imported files
+ * are always written to new inodes, the snapshot is not affected by
+ * later imports. An existing snapshot of the same version is only
+ * replaced if @replace is set.
+ */
+static int osinfo_db_import_snapshot_take(OsinfoDbImportTarget *target,
+                                          gboolean replace)
+{
+    g_autofree gchar *path = g_file_get_path(target->dir);
+    g_autofree gchar *version = osinfo_db_import_snapshot_version(path);
+    g_autofree gchar *snapdir = osinfo_db_import_snapshot_dir(target);
+    g_autofree gchar *snappath = NULL;
+    g_autofree gchar *tmppath = NULL;
+    g_autoptr(GFile) tmp = NULL;
+
+    if (!version)
+        return 0;
+
+    snappath = g_build_filename(snapdir, version, NULL);
+    if (!replace && g_file_test(snappath, G_FILE_TEST_IS_DIR))
+        return 0;
+
+    tmppath = g_strdup_printf("%s/.%s.XXXXXX", snapdir, version);
+    if (g_mkdir_with_parents(snapdir, 0755) < 0 ||
+        !g_mkdtemp_full(tmppath, 0755)) {
+        g_printerr("%s: cannot create snapshot directory %s: %s\n",
+                   argv0, tmppath, g_strerror(errno));
+        return -1;
+    }
+    tmp = g_file_new_for_path(tmppath);
+
+    if (osinfo_db_import_link_tree(path, tmppath) < 0)
+        goto error;
+
+    if (g_file_test(snappath, G_FILE_TEST_IS_DIR)) {
+        g_autoptr(GFile) old = g_file_new_for_path(snappath);
+
+        if (osinfo_db_import_remove_tree(old) < 0)
+            goto error;
+    }
+
+    if (g_rename(tmppath, snappath) < 0) {
+        g_printerr("%s: cannot rename %s to %s: %s\n",
+                   argv0, tmppath, snappath, g_strerror(errno));
+        goto error;
+    }
+
+    /* Snapshots are expired in the order they were taken */
+    g_utime(snappath, NULL);
+
+    return 0;
+
+ error:
+    osinfo_db_import_remove_tree(tmp);
+    return -1;
+}
+
+typedef struct _OsinfoDbImportSnapshot OsinfoDbImportSnapshot;
+struct _OsinfoDbImportSnapshot {
+    gchar *version;
+    gint64 taken;
+};
+
+static gint osinfo_db_import_snapshot_age_compare(gconstpointer a,
+                                                  gconstpointer b)
+{
+    const OsinfoDbImportSnapshot *x = a;
+    const OsinfoDbImportSnapshot *y = b;
+
+    if (x->taken != y->taken)
+        return x->taken < y->taken ? -1 : 1;
+    return g_strcmp0(x->version, y->version);
+}
+
+static void osinfo_db_import_snapshot_clear(gpointer opaque)
+{
+    OsinfoDbImportSnapshot *snap = opaque;
+
+    g_free(snap->version);
+}
+
+/*
+ * Delete all but the @keep snapshots of @target taken last, which
+ * are the versions imported last, as a snapshot is taken after each
+ * import. The snapshot of the installed version is never deleted,
+ * even after a rollback to an older one.
+ */
+static int osinfo_db_import_snapshot_expire(OsinfoDbImportTarget *target,
+                                            guint keep)
+{
+    g_autofree gchar *path = g_file_get_path(target->dir);
+    g_autofree gchar *installed = osinfo_db_import_snapshot_version(path);
+    g_autofree gchar *snapdir = osinfo_db_import_snapshot_dir(target);
+    g_autoptr(GDir) dir = g_dir_open(snapdir, 0, NULL);
+    g_autoptr(GArray) snaps = NULL;
+    const gchar *name;
+    guint i;
+
+    snaps = g_array_new(FALSE, FALSE, sizeof(OsinfoDbImportSnapshot));
+    g_array_set_clear_func(snaps, osinfo_db_import_snapshot_clear);
+
+    /* Ignore snapshots being created */
+    while (dir && (name = g_dir_read_name(dir)) != NULL) {
+        g_autofree gchar *snappath = g_build_filename(snapdir, name, NULL);
+        OsinfoDbImportSnapshot snap;
+        GStatBuf sb;
+
+        if (*name == '.' || g_stat(snappath, &sb) < 0)
+            continue;
+
+        snap.version = g_strdup(name);
+        snap.taken = sb.st_mtime;
+        g_array_append_val(snaps, snap);
+    }
+    g_array_sort(snaps, osinfo_db_import_snapshot_age_compare);
+
+    for (i = 0; i + keep < snaps->len; i++) {
+        OsinfoDbImportSnapshot *snap =
+            &g_array_index(snaps, OsinfoDbImportSnapshot, i);
+        g_autofree gchar *snappath = NULL;
+        g_autoptr(GFile) file = NULL;
+
+        if (g_strcmp0(snap->version, installed) == 0)
+            continue;
+
+        snappath = g_build_filename(snapdir, snap->version, NULL);
+        file = g_file_new_for_path(snappath);
+        if (osinfo_db_import_remove_tree(file) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Swap the snapshot of @version back into place in @target, or the
+ * one with the highest version older than the installed database if
+ * @version is NULL. This goes through the same staging directory and
+ * exchange as --atomic, and only creates hard links, so no file data
+ * is copied. The database being replaced is snapshotted first, if it
+ * was not already, so that the rollback can itself be undone.
+ */
+static int osinfo_db_import_rollback(OsinfoDbImportTarget *target,
+                                     const gchar *version,
+                                     gboolean durable)
+{
+    g_autofree gchar *path = g_file_get_path(target->dir);
+    g_autofree gchar *installed = osinfo_db_import_snapshot_version(path);
+    g_autofree gchar *snapdir = osinfo_db_import_snapshot_dir(target);
+    g_autofree gchar *snappath = NULL;
+    g_autoptr(GPtrArray) versions = NULL;
+    guint i;
+
+    if (!version) {
+        versions = osinfo_db_import_snapshot_list(snapdir);
+        for (i = versions->len; i > 0; i--) {
+            if (installed &&
+                g_strcmp0(g_ptr_array_index(versions, i - 1), installed) < 0) {
+                version = g_ptr_array_index(versions, i - 1);
+                break;
+            }
+        }
+        if (!version) {
+            g_printerr("%s: no snapshot older than the database in %s\n",
+                       argv0, path);
+            return -1;
+        }
+    }
+
+    snappath = g_build_filename(snapdir, version, NULL);
+    if (*version == '.' || strchr(version, '/') ||
+        !g_file_test(snappath, G_FILE_TEST_IS_DIR)) {
+        g_printerr("%s: no snapshot of version %s for %s\n",
+                   argv0, version, path);
+        return -1;
+    }
+
+    if (osinfo_db_import_snapshot_take(target, FALSE) < 0 ||
+        osinfo_db_import_target_begin(target, snappath) < 0 ||
+        osinfo_db_import_target_commit(target, durable) < 0) {
+        osinfo_db_import_target_abort(target);
+        return -1;
+    }
+    osinfo_db_import_target_finish(target);
+
+    g_print("%s: rolled back %s to version %s\n", argv0, path, version);
+    return 0;
+}
+#endif /* !WIN32 */
+
+/*
+ * Enable reading any compression osinfo-db-export can produce,
+ * detected by content. The filters are listed one by one rather than
+ * all of them, as libarchive implements some of the others by running
+ * an external program on the archive. That is also what it falls back
+ * to, returning ARCHIVE_WARN, for a compression library it was built
+ * without, so such a filter is left out, and an archive needing it
+ * is then rejected as unrecognized.
+ */
+static void osinfo_db_import_support_filters(struct archive *arc)
+{
+    static int (*const filters[])(struct archive *) = {
+        archive_read_support_filter_xz,
+        archive_read_support_filter_zstd,
+        archive_read_support_filter_gzip,
+        archive_read_support_filter_bzip2,
+        archive_read_support_filter_lz4,
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(filters); i++) {
+        struct archive *probe = archive_read_new();
+        int r = filters[i](probe);
+
+        archive_read_free(probe);
+        if (r == ARCHIVE_OK)
+            filters[i](arc);
+    }
+}
+
+static gboolean requires_soup(const gchar *source)
+{
+    const gchar *prefixes[] = { "http://", "https://", NULL };
+    gsize i;
+
+    for (i = 0; prefixes[i] != NULL; i++) {
+        if (g_str_has_prefix(source, prefixes[i]))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Extract the archive @source into each of the @ntargets @targets,
+ * decompressing it only once. Entries whose path is already in
+ * @import->claimed, because a higher priority archive provided
+ * them, are skipped.
+ */
+static int osinfo_db_import_extract_one(OsinfoDbImport *import,
+                                        OsinfoDbImportTarget *targets,
+                                        guint ntargets,
+                                        const char *source)
+{
+    struct archive *arc;
+    struct archive_entry *entry;
+    int ret = -1;
+    int r;
+    g_autoptr(GFile) file = NULL;
+    g_autofree gchar *source_file = NULL;
+    OsinfoDbImportSource src = { 0 };
+    gchar *relpath = NULL;
+    gboolean verified;
+
+    arc = archive_read_new();
+    archive_read_support_format_tar(arc);
+    osinfo_db_import_support_filters(arc);
+
+    if (source != NULL && g_str_equal(source, "-"))
+        source = NULL;
+
+    src.fd = -1;
+    if (import->checksum)
+        src.checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+    if (source != NULL && requires_soup(source)) {
+        source_file = g_strdup(source);
+        src.download = osinfo_db_import_download_new(import, source);
+        if (src.download == NULL)
+            goto cleanup;
+
+        /* Found in the archive cache, so read like a local file */
+        if (src.download->cachefd >= 0) {
+            src.fd = src.download->cachefd;
+            src.download->cachefd = -1;
+            src.cached = src.download->cached;
+            src.download->cached = NULL;
+            if (!src.checksum)
+                src.checksum = g_checksum_new(G_CHECKSUM_SHA256);
+            g_clear_pointer(&src.download, osinfo_db_import_download_free);
+            osinfo_db_import_source_open_fd(&src);
+        }
+    } else {
+        if (source != NULL) {
+            file = g_file_new_for_commandline_arg(source);
+            if (file == NULL)
+                goto cleanup;
+
+            source_file = g_file_get_path(file);
+            g_clear_object(&file);
+
+            if (source_file == NULL)
+                goto cleanup;
+
+            src.fd = g_open(source_file, O_RDONLY | O_BINARY, 0);
+            if (src.fd < 0) {
+                g_printerr("%s: cannot open archive %s: %s\n",
+                           argv0, source_file, g_strerror(errno));
+                goto cleanup;
+            }
+        } else {
+            src.fd = STDIN_FILENO;
+        }
+        osinfo_db_import_source_open_fd(&src);
+    }
+
+    r = archive_read_open(arc, &src, NULL, osinfo_db_import_source_read, NULL);
+    if (r != ARCHIVE_OK) {
+        g_printerr("%s: cannot open archive %s: %s\n",
+                   argv0, source_file, archive_error_string(arc));
+        goto cleanup;
+    }
+
+    for (;;) {
+        r = archive_read_next_header(arc, &entry);
+        if (r == ARCHIVE_EOF)
+            break;
+        if (r != ARCHIVE_OK) {
+            g_printerr("%s: cannot read next archive entry in %s: %s\n",
+                       argv0, source_file, archive_error_string(arc));
+            goto cleanup;
+        }
+
+        relpath = g_strdup(osinfo_db_import_get_relpath(entry));
+        if (g_str_has_suffix(relpath, "/"))
+            relpath[strlen(relpath) - 1] = '\0';
+
+        /* Overridden by a higher priority archive */
+        if (import->claimed &&
+            g_hash_table_contains(import->claimed, relpath)) {
+            g_clear_pointer(&relpath, g_free);
+            continue;
+        }
+
+        if (osinfo_db_import_create(import, targets, ntargets, relpath,
+                                    arc, entry) < 0) {
+            goto cleanup;
+        }
+
+        if (import->claimed)
+            g_hash_table_add(import->claimed, g_strdup(relpath));
+        if (import->seen)
+            g_hash_table_add(import->seen, relpath);
+        else
+            g_free(relpath);
+        relpath = NULL;
+    }
+
+    if (osinfo_db_import_source_drain(arc, &src) < 0 ||
+        archive_read_close(arc) != ARCHIVE_OK) {
+        g_printerr("%s: cannot finish reading archive %s: %s\n",
+                   argv0, source_file, archive_error_string(arc));
+        goto cleanup;
+    }
+
+    verified = osinfo_db_import_source_verify(import, &src,
+                                              source_file ? source_file : "-") == 0;
+
+    /* A corrupted partial copy must not be resumed, nor cached */
+    if (src.download)
+        osinfo_db_import_download_done(src.download, verified);
+
+    /*
+     * Only cached once the whole import has succeeded. The lock is
+     * released already, as the same URL may be given again.
+     */
+    if (src.download && src.download->complete && import->downloads) {
+#ifndef WIN32
+        if (src.download->lockfd >= 0) {
+            close(src.download->lockfd);
+            src.download->lockfd = -1;
+        }
+#endif /* !WIN32 */
+        g_ptr_array_add(import->downloads, src.download);
+        src.download = NULL;
+    }
+
+    if (!verified)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    /* A corrupted cached archive may well be why it could not be read */
+    if (src.cached && osinfo_db_import_source_drain(arc, &src) == 0)
+        osinfo_db_import_source_check_cached(&src);
+    archive_read_free(arc);
+    osinfo_db_import_source_close(&src);
+    g_free(relpath);
+    return ret;
+}
+
+/*
+ * Extract the @nsources archives in @sources, in increasing order of
+ * priority, into each of the @ntargets @targets. They are read from
+ * the highest priority one down, so that the first archive providing
+ * a path wins and every file is written exactly once, with its final
+ * content, without holding anything in memory.
+ */
+static int osinfo_db_import_extract(OsinfoDbImport *import,
+                                    OsinfoDbImportTarget *targets,
+                                    guint ntargets,
+                                    const gchar **sources,
+                                    guint nsources)
+{
+    int ret = -1;
+    int r;
+    guint i;
+
+#ifndef WIN32
+    for (i = 0; i < ntargets; i++) {
+        targets[i].dirs =
+            osinfo_db_import_dir_cache_new(osinfo_db_import_target_root(&targets[i]));
+        if (!targets[i].dirs)
+            goto cleanup;
+    }
+#endif /* !WIN32 */
+
+    if (import->jobs > 1)
+        import->pool = osinfo_db_import_pool_new(import, import->jobs);
+
+    if (nsources > 1)
+        import->claimed = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                g_free, NULL);
+    if (import->validate)
+        import->pending = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                g_free,
+                                                (GDestroyNotify)g_bytes_unref);
+
+    for (i = nsources; i > 0; i--) {
+        if (osinfo_db_import_extract_one(import, targets, ntargets,
+                                         sources[i - 1]) < 0)
+            goto cleanup;
+    }
+
+    /* No schema in the archive, fall back to the installed one */
+    if (import->pending && g_hash_table_size(import->pending) > 0) {
+        g_autoptr(GError) err = NULL;
+        OsinfoDbSchema *schema;
+
+        if (!import->schemafile) {
+            g_printerr("%s: no schema to validate the archive against\n",
+                       argv0);
+            goto cleanup;
+        }
+        if (!(schema = osinfo_db_schema_new(import->schemafile, &err))) {
+            g_printerr("%s: %s\n", argv0, err->message);
+            goto cleanup;
+        }
+        if (osinfo_db_import_set_schema(import, schema) < 0)
+            goto cleanup;
     }
 
-    if (version) {
-        *version = g_strdup(json_reader_get_string_value(reader));
-        if (*version == NULL)
-            return FALSE;
-
-        json_reader_end_member(reader); /* "version" */
+    if (import->pool) {
+        r = osinfo_db_import_pool_finish(import->pool);
+        import->pool = NULL;
+        if (r < 0)
+            goto cleanup;
     }
 
-    if (!json_reader_read_member(reader, "archive")) {
-        const GError *error = json_reader_get_error(reader);
-        g_printerr("Failed to read the \"archive\" member of the %s file: %s\n",
-                   from_url, error->message);
-        return FALSE;
+    /* Only prune once the archives are known to be complete */
+    for (i = 0; import->seen && i < ntargets; i++) {
+        gboolean empty;
+
+        if (osinfo_db_import_prune(import,
+                                   osinfo_db_import_target_root(&targets[i]),
+                                   NULL, &empty) < 0)
+            goto cleanup;
     }
 
-    *url = g_strdup(json_reader_get_string_value(reader));
-    if (*url == NULL)
-        return FALSE;
+#ifndef WIN32
+    for (i = 0; import->sync == OSINFO_DB_IMPORT_SYNC_BATCH && i < ntargets; i++) {
+        g_autofree gchar *path =
+            g_file_get_path(osinfo_db_import_target_root(&targets[i]));
 
-    json_reader_end_member(reader); /* "archive" */
-    json_reader_end_member(reader); /* "release" */
+        if (osinfo_db_import_sync_tree(path) < 0)
+            goto cleanup;
+    }
+#endif /* !WIN32 */
 
-    return TRUE;
+    ret = 0;
+ cleanup:
+    if (import->pool) {
+        osinfo_db_import_pool_finish(import->pool);
+        import->pool = NULL;
+    }
+    g_clear_pointer(&import->claimed, g_hash_table_unref);
+    g_clear_pointer(&import->pending, g_hash_table_unref);
+    g_clear_pointer(&import->schema, osinfo_db_schema_free);
+#ifndef WIN32
+    for (i = 0; i < ntargets; i++)
+        g_clear_pointer(&targets[i].dirs, osinfo_db_import_dir_cache_free);
+#endif /* !WIN32 */
+    return ret;
 }
 
-static gboolean osinfo_db_get_latest_info(gchar **version,
-                                          gchar **url)
+/*
+ * With --serve, the release information at @upstream is served to
+ * the hosts of a site as @name, with the archive URL pointing back
+ * to this server, which serves the archive from the archive cache.
+ * Both are fetched from upstream by a thread of their own every
+ * OSINFO_DB_IMPORT_SERVE_INTERVAL seconds, and the archive only when
+ * it has changed, so requests are never held up by upstream, however
+ * many hosts ask for them. That thread is the only one to use the
+ * SoupSession, as libsoup does not allow sharing one between threads.
+ * @lock protects what is being served, and @started and @failed tell
+ * how the first refresh went.
+ */
+typedef struct _OsinfoDbImportMirror OsinfoDbImportMirror;
+struct _OsinfoDbImportMirror {
+    OsinfoDbImport *import;
+    const gchar *upstream;
+    gchar *name;
+    guint port;
+
+    /* Validators of the release information last fetched in full */
+    GKeyFile *cache;
+
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    gboolean started;
+    gboolean failed;
+    gboolean stale;
+
+    JsonNode *root;
+    gchar *archive;
+    gchar *digest;
+    gchar *checksum;
+};
+
+static void osinfo_db_import_mirror_clear(OsinfoDbImportMirror *mirror)
 {
-    return osinfo_db_get_info(LATEST_URI, version, url);
+    g_free(mirror->name);
+    if (mirror->cache)
+        g_key_file_free(mirror->cache);
+    if (mirror->root)
+        json_node_free(mirror->root);
+    g_free(mirror->archive);
+    g_free(mirror->digest);
+    g_free(mirror->checksum);
+    g_mutex_clear(&mirror->lock);
+    g_cond_clear(&mirror->cond);
 }
 
-static gboolean osinfo_db_get_nightly_info(gchar **url)
+/*
+ * Fetch the release information again, along with the archive if it
+ * has changed, or unconditionally if @force is set. The validators
+ * of the release information are only kept once the archive is in
+ * the cache, so that a failed download is retried the next time
+ * rather than answered by a 304. On error, what was fetched last
+ * keeps being served.
+ */
+static int osinfo_db_import_mirror_refresh(OsinfoDbImportMirror *mirror,
+                                           gboolean force)
 {
-    return osinfo_db_get_info(NIGHTLY_URI, NULL, url);
+    g_autoptr(GKeyFile) cache = g_key_file_new();
+    g_autofree gchar *data = NULL;
+    g_autofree gchar *url = NULL;
+    g_autofree gchar *checksum = NULL;
+    gchar *digest = NULL;
+    JsonNode *root = NULL;
+    goffset size;
+    gboolean unchanged;
+    gsize len;
+
+    if (!force) {
+        data = g_key_file_to_data(mirror->cache, &len, NULL);
+        g_key_file_load_from_data(cache, data, len, G_KEY_FILE_NONE, NULL);
+    }
+
+    if (!osinfo_db_get_info(mirror->upstream, cache, NULL, &url,
+                            &checksum, &size, &unchanged, &root))
+        return -1;
+
+    if (unchanged)
+        return 0;
+
+    /* Either the one published upstream, or none */
+    mirror->import->checksum = checksum;
+    mirror->import->size = -1;
+    digest = osinfo_db_import_archive_cache_fetch(mirror->import, url);
+    mirror->import->checksum = NULL;
+    if (!digest) {
+        json_node_free(root);
+        return -1;
+    }
+
+    g_key_file_free(mirror->cache);
+    mirror->cache = cache;
+    cache = NULL;
+
+    g_mutex_lock(&mirror->lock);
+    if (mirror->root)
+        json_node_free(mirror->root);
+    mirror->root = root;
+    g_free(mirror->archive);
+    mirror->archive = g_path_get_basename(url);
+    g_free(mirror->digest);
+    mirror->digest = digest;
+    g_free(mirror->checksum);
+    mirror->checksum = checksum;
+    checksum = NULL;
+    g_mutex_unlock(&mirror->lock);
+
+    return 0;
 }
 
-static gboolean requires_soup(const gchar *source)
+/*
+ * Refresh the mirror a first time, giving up if that fails, and then
+ * every OSINFO_DB_IMPORT_SERVE_INTERVAL seconds, or straight away
+ * when the archive being served has gone.
+ */
+static gpointer osinfo_db_import_mirror_thread(gpointer opaque)
 {
-    const gchar *prefixes[] = { "http://", "https://", NULL };
-    gsize i;
+    OsinfoDbImportMirror *mirror = opaque;
+    gboolean failed;
+
+    failed = osinfo_db_import_mirror_refresh(mirror, FALSE) < 0;
+    g_mutex_lock(&mirror->lock);
+    mirror->started = TRUE;
+    mirror->failed = failed;
+    g_cond_broadcast(&mirror->cond);
+    g_mutex_unlock(&mirror->lock);
+    if (failed)
+        return NULL;
 
-    for (i = 0; prefixes[i] != NULL; i++) {
-        if (g_str_has_prefix(source, prefixes[i]))
-            return TRUE;
+    for (;;) {
+        gint64 deadline = g_get_monotonic_time() +
+            OSINFO_DB_IMPORT_SERVE_INTERVAL * G_USEC_PER_SEC;
+        gboolean force;
+
+        g_mutex_lock(&mirror->lock);
+        while (!mirror->stale &&
+               g_cond_wait_until(&mirror->cond, &mirror->lock, deadline))
+            ;
+        force = mirror->stale;
+        mirror->stale = FALSE;
+        g_mutex_unlock(&mirror->lock);
+
+        osinfo_db_import_mirror_refresh(mirror, force);
     }
 
-    return FALSE;
+    return NULL;
 }
 
-static int osinfo_db_import_extract(GFile *target,
-                                    const char *source,
-                                    gboolean verbose)
+/*
+ * The release information as served to the host which asked for it
+ * through @host, with the archive URL pointing to this server, and
+ * the digest and size of the archive so that they can be checked.
+ * Returns NULL if the archive is not in the cache any more, in which
+ * case it is fetched again in the background.
+ */
+static gchar *osinfo_db_import_mirror_metadata(OsinfoDbImportMirror *mirror,
+                                               const gchar *host,
+                                               gsize *len)
 {
-    struct archive *arc;
-    struct archive_entry *entry;
-    int ret = -1;
-    int r;
-    g_autoptr(GFile) file = NULL;
-    g_autofree gchar *source_file = NULL;
-    gboolean file_is_native = TRUE;
+    g_autoptr(JsonGenerator) generator = json_generator_new();
+    g_autofree gchar *fallback = NULL;
+    g_autofree gchar *url = NULL;
+    g_autofree gchar *path = NULL;
+    JsonObject *release;
+    GStatBuf st;
+    gchar *data = NULL;
+
+    g_mutex_lock(&mirror->lock);
+
+    path = g_build_filename(mirror->import->archives->path, mirror->digest, NULL);
+    if (g_stat(path, &st) < 0) {
+        /* Evicted from the cache, so fetch it again */
+        mirror->stale = TRUE;
+        g_cond_signal(&mirror->cond);
+        goto cleanup;
+    }
 
-    arc = archive_read_new();
+    if (!host)
+        host = fallback = g_strdup_printf("%s:%u", g_get_host_name(), mirror->port);
+    url = g_strdup_printf("http://%s/archives/%s/%s",
+                          host, mirror->digest, mirror->archive);
 
-    archive_read_support_format_tar(arc);
-    archive_read_support_filter_xz(arc);
+    release = json_object_get_object_member(json_node_get_object(mirror->root),
+                                            "release");
+    json_object_set_string_member(release, "archive", url);
+    json_object_set_string_member(release, "sha256", mirror->digest);
+    json_object_set_int_member(release, "size", st.st_size);
 
-    if (source != NULL && g_str_equal(source, "-"))
-        source = NULL;
+    json_generator_set_root(generator, mirror->root);
+    data = json_generator_to_data(generator, len);
 
-    if (source != NULL) {
-        file_is_native = !requires_soup(source);
+ cleanup:
+    g_mutex_unlock(&mirror->lock);
+    return data;
+}
 
-        if (file_is_native) {
-            file = g_file_new_for_commandline_arg(source);
-            if (file == NULL)
-                goto cleanup;
+static void osinfo_db_import_mirror_handler(SoupServer *server,
+                                            SoupServerMessage *message,
+                                            const char *path,
+                                            GHashTable *query,
+#if SOUP_MAJOR_VERSION < 3
+                                            SoupClientContext *client,
+#endif
+                                            gpointer opaque)
+{
+    OsinfoDbImportMirror *mirror = opaque;
+    SoupMessageHeaders *request = soup_server_message_get_request_headers(message);
+    SoupMessageHeaders *response = soup_server_message_get_response_headers(message);
+    const gchar *method = soup_server_message_get_method(message);
+    const gchar *match = soup_message_headers_get_one(request, "If-None-Match");
+    g_autoptr(GBytes) body = NULL;
+    g_autofree gchar *etag = NULL;
+    g_autofree gchar *digest = NULL;
+    const gchar *type;
+
+    if (!g_str_equal(method, "GET") && !g_str_equal(method, "HEAD")) {
+        soup_message_headers_replace(response, "Allow", "GET, HEAD");
+        soup_server_message_set_status(message, SOUP_STATUS_METHOD_NOT_ALLOWED, NULL);
+        return;
+    }
 
-            source_file = g_file_get_path(file);
-            g_clear_object(&file);
-        } else {
-            source_file = osinfo_db_import_download_file(source);
+    if (path[0] == '/' && g_str_equal(path + 1, mirror->name)) {
+        g_autoptr(GChecksum) checksum = g_checksum_new(G_CHECKSUM_SHA256);
+        gchar *data;
+        gsize len;
+
+        data = osinfo_db_import_mirror_metadata(mirror,
+                                                soup_message_headers_get_one(request, "Host"),
+                                                &len);
+        if (!data) {
+            soup_server_message_set_status(message, SOUP_STATUS_SERVICE_UNAVAILABLE, NULL);
+            return;
         }
+        body = g_bytes_new_take(data, len);
+        g_checksum_update(checksum, (const guchar *)data, len);
+        etag = g_strdup_printf("\"%s\"", g_checksum_get_string(checksum));
+        type = "application/json";
+    } else if (g_str_has_prefix(path, "/archives/")) {
+        g_autofree gchar *file = NULL;
+        GMappedFile *mapped = NULL;
+
+        /* Archives are looked up by digest, whatever their name */
+        digest = g_strndup(path + strlen("/archives/"),
+                           strcspn(path + strlen("/archives/"), "/"));
+        if (osinfo_db_import_is_sha256(digest)) {
+            file = g_build_filename(mirror->import->archives->path, digest, NULL);
+            mapped = g_mapped_file_new(file, FALSE, NULL);
+        }
+        if (!mapped) {
+            soup_server_message_set_status(message, SOUP_STATUS_NOT_FOUND, NULL);
+            return;
+        }
+        /* Mapped rather than read, as it may be sent to many hosts */
+        body = g_mapped_file_get_bytes(mapped);
+        g_mapped_file_unref(mapped);
+        g_utime(file, NULL);
+        etag = g_strdup_printf("\"%s\"", digest);
+        type = "application/octet-stream";
+    } else {
+        soup_server_message_set_status(message, SOUP_STATUS_NOT_FOUND, NULL);
+        return;
+    }
 
-        if (source_file == NULL)
-            goto cleanup;
+    soup_message_headers_replace(response, "ETag", etag);
+    if (match && g_str_equal(match, etag)) {
+        soup_server_message_set_status(message, SOUP_STATUS_NOT_MODIFIED, NULL);
+        return;
     }
 
-    if ((r = archive_read_open_filename(arc, source_file, 10240)) != ARCHIVE_OK) {
-        g_printerr("%s: cannot open archive %s: %s\n",
-                   argv0, source_file, archive_error_string(arc));
-        goto cleanup;
+    soup_message_headers_set_content_type(response, type, NULL);
+    soup_message_body_append_bytes(soup_server_message_get_response_body(message),
+                                   body);
+    soup_server_message_set_status(message, SOUP_STATUS_OK, NULL);
+}
+
+/* Serve the release information and archives on @port until killed */
+static int osinfo_db_import_serve(OsinfoDbImportMirror *mirror,
+                                  guint port)
+{
+    g_autoptr(SoupServer) server = NULL;
+    g_autoptr(GMainLoop) loop = NULL;
+    g_autoptr(GError) err = NULL;
+    GSList *listeners;
+    gboolean failed;
+
+    server = soup_server_new("server-header", "osinfo-db-import ", NULL);
+    soup_server_add_handler(server, NULL, osinfo_db_import_mirror_handler,
+                            mirror, NULL);
+    if (!soup_server_listen_all(server, port, 0, &err)) {
+        g_printerr("%s: cannot listen on port %u: %s\n",
+                   argv0, port, err->message);
+        return -1;
     }
 
-    for (;;) {
-        r = archive_read_next_header(arc, &entry);
-        if (r == ARCHIVE_EOF)
-            break;
-        if (r != ARCHIVE_OK) {
-            g_printerr("%s: cannot read next archive entry in %s: %s\n",
-                       argv0, source_file, archive_error_string(arc));
-            goto cleanup;
-        }
+    /* The port picked by the system, if 0 was given */
+    mirror->port = port;
+    listeners = soup_server_get_listeners(server);
+    if (listeners) {
+        g_autoptr(GSocketAddress) address =
+            g_socket_get_local_address(listeners->data, NULL);
 
-        file = osinfo_db_import_get_file(target, entry);
-        if (osinfo_db_import_create(file, arc, entry, verbose) < 0) {
-            goto cleanup;
-        }
-        g_clear_object(&file);
+        if (address && G_IS_INET_SOCKET_ADDRESS(address))
+            mirror->port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(address));
+    }
+    g_slist_free(listeners);
+
+    mirror->thread = g_thread_new("osinfo-db-import-mirror",
+                                  osinfo_db_import_mirror_thread, mirror);
+
+    /* Nothing to serve until the first refresh has succeeded */
+    g_mutex_lock(&mirror->lock);
+    while (!mirror->started)
+        g_cond_wait(&mirror->cond, &mirror->lock);
+    failed = mirror->failed;
+    g_mutex_unlock(&mirror->lock);
+    if (failed) {
+        g_thread_join(mirror->thread);
+        return -1;
     }
 
-    if (archive_read_close(arc) != ARCHIVE_OK) {
-        g_printerr("%s: cannot finish reading archive %s: %s\n",
-                   argv0, source_file, archive_error_string(arc));
-        goto cleanup;
+    g_print(_("%s: serving %s as /%s on port %u\n"),
+            argv0, mirror->upstream, mirror->name, mirror->port);
+    fflush(stdout);
+
+    loop = g_main_loop_new(NULL, FALSE);
+    g_main_loop_run(loop);
+
+    return 0;
+}
+
+/*
+ * Lower the I/O priority of the import, which the writer threads
+ * created later inherit. Best-effort uses the lowest level of its
+ * class, so that the import still makes progress on a busy disk,
+ * whereas idle only gets the disk when nothing else uses it.
+ */
+static int osinfo_db_import_set_io_priority(const gchar *priority)
+{
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    int ioprio;
+
+    if (g_str_equal(priority, "idle")) {
+        ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+    } else if (g_str_equal(priority, "best-effort")) {
+        ioprio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7;
+    } else {
+        g_printerr(_("%s: unknown I/O priority '%s', expected idle or best-effort\n"),
+                   argv0, priority);
+        return -1;
     }
 
-    ret = 0;
- cleanup:
-    archive_read_free(arc);
-    if (!file_is_native && source_file != NULL)
-        unlink(source_file);
-    return ret;
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) < 0) {
+        g_printerr(_("%s: cannot set I/O priority: %s\n"),
+                   argv0, g_strerror(errno));
+        return -1;
+    }
+
+    return 0;
+#else
+    g_printerr(_("%s: --io-priority is not supported on this platform\n"),
+               argv0);
+    return -1;
+#endif
+}
+
+static gboolean rollback = FALSE;
+static gchar *rollback_version = NULL;
+
+static gboolean osinfo_db_import_parse_rollback(const gchar *option_name,
+                                                const gchar *value,
+                                                gpointer data,
+                                                GError **error)
+{
+    rollback = TRUE;
+    g_free(rollback_version);
+    rollback_version = g_strdup(value);
+    return TRUE;
 }
 
 gint main(gint argc, gchar **argv)
 {
     g_autoptr(GOptionContext) context = NULL;
     g_autoptr(GError) error = NULL;
-    g_autoptr(GFile) dir = NULL;
     gboolean verbose = FALSE;
     gboolean user = FALSE;
     gboolean local = FALSE;
     gboolean system = FALSE;
     gboolean latest = FALSE;
     gboolean nightly = FALSE;
+    gboolean atomic = FALSE;
+#ifndef WIN32
+    const gchar *staged_for = NULL;
+#endif /* !WIN32 */
+    gboolean skip_unchanged = FALSE;
+    gboolean prune = FALSE;
+    const gchar *sync = NULL;
+    gint jobs = 1;
+    gboolean check_only = FALSE;
+    const gchar *metadata_url = NULL;
+    const gchar *checksum = NULL;
+    const gchar *content_store = NULL;
+    gboolean reflink = FALSE;
+    gint keep_snapshots = 0;
+    gboolean validate = FALSE;
+    gint64 cache_size = OSINFO_DB_IMPORT_CACHE_SIZE;
+    const gchar *shared_cache = NULL;
+    gint serve = -1;
+    const gchar *io_priority = NULL;
+    gint64 max_write_rate = 0;
+    gboolean lower_priority = FALSE;
+    g_autofree gchar *archive_checksum = NULL;
+    goffset archive_size = -1;
+    g_autoptr(GKeyFile) cache = NULL;
+    OsinfoDbImport import = { 0 };
+    OsinfoDbImportTarget *targets = NULL;
+    guint ntargets = 0;
+    gboolean failed = FALSE;
+    int ret = EXIT_FAILURE;
+    guint i, j;
     g_autofree gchar *installed_version = NULL;
     g_autofree gchar *latest_version = NULL;
     g_autofree gchar *archive_url = NULL;
-    const gchar *root = "";
+    g_auto(GStrv) roots = NULL;
     const gchar *archive = NULL;
-    const gchar *custom = NULL;
+    const gchar **archives = &archive;
+    guint narchives = 1;
+    g_auto(GStrv) customs = NULL;
     int locs = 0;
     const GOptionEntry entries[] = {
       { "verbose", 'v', 0, G_OPTION_ARG_NONE, (void*)&verbose,
@@ -457,14 +4124,53 @@ gint main(gint argc, gchar **argv)
         N_("Import into local directory"), NULL, },
       { "system", 0, 0, G_OPTION_ARG_NONE, (void *)&system,
         N_("Import into system directory"), NULL, },
-      { "dir", 0, 0, G_OPTION_ARG_STRING, (void *)&custom,
-        N_("Import into custom directory"), NULL, },
-      { "root", 0, 0, G_OPTION_ARG_STRING, &root,
-        N_("Installation root directory"), NULL, },
+      { "dir", 0, 0, G_OPTION_ARG_STRING_ARRAY, (void *)&customs,
+        N_("Import into custom directory, may be repeated"), NULL, },
+      { "root", 0, 0, G_OPTION_ARG_STRING_ARRAY, &roots,
+        N_("Installation root directory, may be repeated"), NULL, },
       { "latest", 0, 0, G_OPTION_ARG_NONE, (void *)&latest,
         N_("Import the latest osinfo-db from osinfo-db's website"), NULL, },
       { "nightly", 0, 0, G_OPTION_ARG_NONE, (void *)&nightly,
         N_("Import the latest nightly build of unreleased osinfo-db from osinfo-db's website"), NULL, },
+      { "atomic", 0, 0, G_OPTION_ARG_NONE, (void *)&atomic,
+        N_("Replace the database in a single step once fully extracted"), NULL, },
+      { "skip-unchanged", 0, 0, G_OPTION_ARG_NONE, (void *)&skip_unchanged,
+        N_("Do not rewrite files whose content is already installed"), NULL, },
+      { "prune", 0, 0, G_OPTION_ARG_NONE, (void *)&prune,
+        N_("Remove installed files which are not in the archive"), NULL, },
+      { "sync", 0, 0, G_OPTION_ARG_STRING, &sync,
+        N_("How to flush files to disk: none, batch or full"), NULL, },
+      { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+        N_("Number of threads writing files"), NULL, },
+      { "check-only", 0, 0, G_OPTION_ARG_NONE, (void *)&check_only,
+        N_("Only check whether an update is available"), NULL, },
+      { "metadata-url", 0, 0, G_OPTION_ARG_STRING, &metadata_url,
+        N_("Fetch the release information from another URL"), NULL, },
+      { "checksum", 0, 0, G_OPTION_ARG_STRING, &checksum,
+        N_("Expected SHA-256 digest of the archive"), NULL, },
+      { "content-store", 0, 0, G_OPTION_ARG_FILENAME, &content_store,
+        N_("Share file content through a content-addressed store"), NULL, },
+      { "reflink", 0, 0, G_OPTION_ARG_NONE, (void *)&reflink,
+        N_("Copy files from the content store as reflinks"), NULL, },
+      { "validate", 0, 0, G_OPTION_ARG_NONE, (void *)&validate,
+        N_("Validate XML files against the schema before installing them"), NULL, },
+      { "cache-size", 0, 0, G_OPTION_ARG_INT64, &cache_size,
+        N_("Maximum size in bytes of the downloaded archives kept"), NULL, },
+      { "shared-cache", 0, 0, G_OPTION_ARG_FILENAME, &shared_cache,
+        N_("Keep downloaded archives in a directory shared by all users"), NULL, },
+      { "serve", 0, 0, G_OPTION_ARG_INT, &serve,
+        N_("Serve the release information and archive to other hosts on a port"), NULL, },
+      { "io-priority", 0, 0, G_OPTION_ARG_STRING, &io_priority,
+        N_("I/O scheduling class: idle or best-effort"), NULL, },
+      { "max-write-rate", 0, 0, G_OPTION_ARG_INT64, &max_write_rate,
+        N_("Maximum number of bytes written per second"), NULL, },
+      { "nice", 0, 0, G_OPTION_ARG_NONE, (void *)&lower_priority,
+        N_("Run with a lower CPU scheduling priority"), NULL, },
+      { "keep-snapshots", 0, 0, G_OPTION_ARG_INT, &keep_snapshots,
+        N_("Number of imported versions to keep as snapshots"), NULL, },
+      { "rollback", 0, G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK,
+        (void *)osinfo_db_import_parse_rollback,
+        N_("Go back to a previous snapshot of the database"), NULL, },
       { NULL, 0, 0, 0, NULL, NULL, NULL },
     };
     argv0 = argv[0];
@@ -485,7 +4191,7 @@ gint main(gint argc, gchar **argv)
         return EXIT_FAILURE;
     }
 
-    if (argc > 2) {
+    if (argc > 2 && (latest || nightly || checksum)) {
         g_printerr(_("%s: expected path to one archive file to import\n"),
                    argv0);
         return EXIT_FAILURE;
@@ -498,45 +4204,430 @@ gint main(gint argc, gchar **argv)
          return EXIT_FAILURE;
     }
 
+    if ((check_only || metadata_url || serve >= 0) && !latest && !nightly) {
+        g_printerr(_("%s: --check-only, --metadata-url and --serve require --latest or --nightly\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
+
+    if (serve > 65535) {
+        g_printerr(_("%s: invalid port %d\n"), argv0, serve);
+        return EXIT_FAILURE;
+    }
+    if (serve >= 0 && (argc >= 2 || check_only || rollback || cache_size == 0)) {
+        g_printerr(_("%s: --serve cannot be used with an archive, --check-only, --rollback or a --cache-size of 0\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
+
     if (local)
         locs++;
     if (system)
         locs++;
     if (user)
         locs++;
-    if (custom)
+    if (customs)
         locs++;
     if (locs > 1) {
         g_printerr(_("Only one of --user, --local, --system & --dir can be used\n"));
         return EXIT_FAILURE;
     }
 
-    archive = argc == 2 ? argv[1] : NULL;
-    dir = osinfo_db_get_path(root, user, local, system, custom);
+    if (sync == NULL || g_str_equal(sync, "none")) {
+        import.sync = OSINFO_DB_IMPORT_SYNC_NONE;
+    } else if (g_str_equal(sync, "batch")) {
+        import.sync = OSINFO_DB_IMPORT_SYNC_BATCH;
+    } else if (g_str_equal(sync, "full")) {
+        import.sync = OSINFO_DB_IMPORT_SYNC_FULL;
+    } else {
+        g_printerr(_("%s: unknown sync mode '%s', expected none, batch or full\n"),
+                   argv0, sync);
+        return EXIT_FAILURE;
+    }
+    if (jobs < 1) {
+        g_printerr(_("%s: --jobs must be at least 1\n"), argv0);
+        return EXIT_FAILURE;
+    }
+    import.jobs = jobs;
+
+    if (keep_snapshots < 0) {
+        g_printerr(_("%s: --keep-snapshots must not be negative\n"), argv0);
+        return EXIT_FAILURE;
+    }
+    if (rollback && (argc >= 2 || latest || nightly)) {
+        g_printerr(_("%s: --rollback cannot be used with an archive, --latest or --nightly\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
+
+    if (reflink && !content_store) {
+        g_printerr(_("%s: --reflink requires --content-store\n"), argv0);
+        return EXIT_FAILURE;
+    }
 
-    if (nightly) {
-        if (!osinfo_db_get_nightly_info(&archive_url))
-            return EXIT_FAILURE;
+    if (cache_size < 0) {
+        g_printerr(_("%s: --cache-size must not be negative\n"), argv0);
+        return EXIT_FAILURE;
+    }
+    if (shared_cache && cache_size == 0) {
+        g_printerr(_("%s: --shared-cache cannot be used with a --cache-size of 0\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
 
-        archive = archive_url;
-    } else if (latest) {
-        if (!osinfo_db_get_installed_version(dir, &installed_version))
-            return EXIT_FAILURE;
+#ifdef WIN32
+    if (import.sync != OSINFO_DB_IMPORT_SYNC_NONE) {
+        g_printerr(_("%s: --sync is not supported on this platform\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
+    if (content_store) {
+        g_printerr(_("%s: --content-store is not supported on this platform\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
+    if (keep_snapshots || rollback) {
+        g_printerr(_("%s: snapshots are not supported on this platform\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
+    if (shared_cache) {
+        g_printerr(_("%s: --shared-cache is not supported on this platform\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
+    if (lower_priority) {
+        g_printerr(_("%s: --nice is not supported on this platform\n"),
+                   argv0);
+        return EXIT_FAILURE;
+    }
+#endif /* WIN32 */
+
+    if (max_write_rate < 0) {
+        g_printerr(_("%s: --max-write-rate must not be negative\n"), argv0);
+        return EXIT_FAILURE;
+    }
+
+    /* Before any thread is created, so that they all inherit them */
+    if (io_priority && osinfo_db_import_set_io_priority(io_priority) < 0)
+        return EXIT_FAILURE;
+#ifndef WIN32
+    errno = 0;
+    if (lower_priority && nice(10) == -1 && errno != 0) {
+        g_printerr(_("%s: cannot lower the scheduling priority: %s\n"),
+                   argv0, g_strerror(errno));
+        return EXIT_FAILURE;
+    }
+#endif /* !WIN32 */
+
+    import.rate = max_write_rate;
+    import.tokens = max_write_rate;
+    import.refilled = g_get_monotonic_time();
+    g_mutex_init(&import.ratelock);
+
+    if (serve >= 0) {
+        OsinfoDbImportMirror mirror = { 0 };
+        g_autofree gchar *cachepath = NULL;
+        g_autofree gchar *upstream = NULL;
+
+        if (metadata_url == NULL)
+            metadata_url = nightly ? NIGHTLY_URI : LATEST_URI;
+
+        cachepath = shared_cache ? g_strdup(shared_cache) :
+            osinfo_db_import_get_cache_path("archives");
+        if (!(import.archives = osinfo_db_import_archive_cache_new(cachepath, cache_size,
+                                                                   shared_cache != NULL)))
+            goto cleanup;
+
+        /* Served under the same name as upstream */
+        upstream = g_strndup(metadata_url, strcspn(metadata_url, "?#"));
+        mirror.import = &import;
+        mirror.upstream = metadata_url;
+        mirror.name = g_path_get_basename(upstream);
+        mirror.cache = g_key_file_new();
+        g_mutex_init(&mirror.lock);
+        g_cond_init(&mirror.cond);
+        if (osinfo_db_import_serve(&mirror, serve) == 0)
+            ret = EXIT_SUCCESS;
+        osinfo_db_import_mirror_clear(&mirror);
+        goto cleanup;
+    }
+
+    /* Standard input, unless archive files are given */
+    if (argc >= 2) {
+        archives = (const gchar **)argv + 1;
+        narchives = argc - 1;
+    }
 
-        if (!osinfo_db_get_latest_info(&latest_version, &archive_url))
-            return EXIT_FAILURE;
+    /* Every combination of root and location is imported into */
+    targets = g_new0(OsinfoDbImportTarget,
+                     (roots ? g_strv_length(roots) : 1) *
+                     (customs ? g_strv_length(customs) : 1));
+    for (i = 0; i == 0 || (roots && roots[i]); i++) {
+        for (j = 0; j == 0 || (customs && customs[j]); j++) {
+            g_autoptr(GFile) dir =
+                osinfo_db_get_path(roots ? roots[i] : "", user, local, system,
+                                   customs ? customs[j] : NULL);
+            guint k;
+
+            for (k = 0; k < ntargets; k++) {
+                if (osinfo_db_import_target_overlaps(targets[k].dir, dir))
+                    break;
+            }
+            if (k < ntargets) {
+                g_autofree gchar *path = g_file_get_path(dir);
+                g_autofree gchar *other = g_file_get_path(targets[k].dir);
+                g_printerr(_("%s: %s overlaps with %s\n"), argv0, path, other);
+                goto cleanup;
+            }
+
+            targets[ntargets++].dir = g_object_ref(dir);
+        }
+    }
+
+#ifndef WIN32
+    if (rollback) {
+        for (i = 0; i < ntargets; i++) {
+            if (osinfo_db_import_rollback(&targets[i], rollback_version,
+                                          import.sync != OSINFO_DB_IMPORT_SYNC_NONE) < 0)
+                goto cleanup;
+        }
+        ret = EXIT_SUCCESS;
+        goto cleanup;
+    }
+#endif /* !WIN32 */
+
+    if (nightly || latest) {
+        gboolean unchanged;
+
+        if (metadata_url == NULL)
+            metadata_url = nightly ? NIGHTLY_URI : LATEST_URI;
+
+        /* Each target may be at a different version, so ask for everything */
+        if (ntargets == 1)
+            cache = osinfo_db_import_cache_load(metadata_url, targets[0].dir);
+        else
+            cache = g_key_file_new();
+
+        /* Update if any of the targets is older than the latest release */
+        for (i = 0; latest && i < ntargets; i++) {
+            gchar *version = NULL;
+
+            if (!osinfo_db_get_installed_version(targets[i].dir, &version))
+                goto cleanup;
+
+            if (i == 0 || g_strcmp0(version, installed_version) < 0) {
+                g_free(installed_version);
+                installed_version = version;
+            } else {
+                g_free(version);
+            }
+        }
+
+        if (!osinfo_db_get_info(metadata_url, cache,
+                                latest ? &latest_version : NULL,
+                                &archive_url, &archive_checksum,
+                                &archive_size, &unchanged, NULL))
+            goto cleanup;
+
+        /* Same metadata as when this database was last updated */
+        if (unchanged) {
+            ret = EXIT_SUCCESS;
+            goto cleanup;
+        }
+
+        if (latest && g_strcmp0(latest_version, installed_version) <= 0) {
+            for (i = 0; !check_only && i < ntargets; i++)
+                osinfo_db_import_cache_save(metadata_url, targets[i].dir, cache);
+            ret = EXIT_SUCCESS;
+            goto cleanup;
+        }
 
-        if (g_strcmp0(latest_version, installed_version) <= 0) {
-            return EXIT_SUCCESS;
+        if (check_only) {
+            g_print(_("%s: an update is available from %s\n"),
+                    argv0, archive_url);
+            ret = OSINFO_DB_IMPORT_EXIT_UPDATE;
+            goto cleanup;
         }
 
         archive = archive_url;
+        archives = &archive;
+        narchives = 1;
     }
 
-    if (osinfo_db_import_extract(dir, archive, verbose) < 0)
-        return EXIT_FAILURE;
+    /* The one given on the command line takes precedence */
+    if (checksum == NULL)
+        checksum = archive_checksum;
+    if (checksum != NULL && !osinfo_db_import_is_sha256(checksum)) {
+        g_printerr(_("%s: invalid SHA-256 checksum '%s'\n"), argv0, checksum);
+        goto cleanup;
+    }
+    import.checksum = checksum;
+    import.size = archive_size;
+
+#ifndef WIN32
+    /*
+     * The digest is only known once the whole archive has been read,
+     * so extract it aside to be able to discard it on a mismatch.
+     */
+    if (!atomic) {
+        if (validate)
+            staged_for = "--validate";
+        else if (import.checksum && import.checksum != archive_checksum)
+            staged_for = "--checksum";
+        else if (import.checksum || import.size >= 0)
+            staged_for = "the checksum published for the release";
+        atomic = staged_for != NULL;
+    }
+#endif /* !WIN32 */
+
+    if (validate) {
+        import.validate = TRUE;
+        import.schemafile = osinfo_db_import_find_schema(roots, customs,
+                                                         user, local, system);
+    }
 
-    return EXIT_SUCCESS;
+    import.skip_unchanged = skip_unchanged;
+    import.verbose = verbose;
+#ifndef WIN32
+    if (content_store &&
+        !(import.content = osinfo_db_import_content_store_new(content_store,
+                                                              reflink)))
+        goto cleanup;
+#endif /* !WIN32 */
+    if (prune)
+        import.seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    /* Only an explicitly requested shared cache is required to work */
+    for (i = 0; cache_size > 0 && i < narchives; i++) {
+        g_autofree gchar *cachepath = NULL;
+
+        if (!archives[i] || !requires_soup(archives[i]))
+            continue;
+
+        cachepath = shared_cache ? g_strdup(shared_cache) :
+            osinfo_db_import_get_cache_path("archives");
+        import.archives = osinfo_db_import_archive_cache_new(cachepath, cache_size,
+                                                             shared_cache != NULL);
+        if (!import.archives && shared_cache)
+            goto cleanup;
+        if (import.archives)
+            import.downloads =
+                g_ptr_array_new_with_free_func((GDestroyNotify)osinfo_db_import_download_free);
+        break;
+    }
+
+#ifndef WIN32
+    /*
+     * A cached archive is only checked against its digest once it is
+     * extracted, so stage the import when one may be used, or else do
+     * without the cache.
+     */
+    if (!atomic && import.archives && !shared_cache) {
+        for (i = 0; i < ntargets; i++) {
+            if (osinfo_db_import_target_cannot_stage(&targets[i]))
+                break;
+        }
+        if (i < ntargets) {
+            g_clear_pointer(&import.downloads, g_ptr_array_unref);
+            g_clear_pointer(&import.archives, osinfo_db_import_archive_cache_free);
+        }
+    }
+    if (!atomic && import.archives) {
+        staged_for = shared_cache ? "--shared-cache" : NULL;
+        atomic = TRUE;
+    }
+#endif /* !WIN32 */
+
+#ifndef WIN32
+    /* Fail up front rather than once the whole archive is extracted */
+    for (i = 0; atomic && i < ntargets; i++) {
+        g_autofree gchar *path = NULL;
+        const gchar *reason;
+
+        if (!(reason = osinfo_db_import_target_cannot_stage(&targets[i])))
+            continue;
+
+        path = g_file_get_path(targets[i].dir);
+        if (staged_for)
+            g_printerr(_("%s: %s needs the import to be staged next to %s, "
+                         "but %s\n"),
+                       argv0, staged_for, path, reason);
+        else
+            g_printerr(_("%s: cannot stage the import next to %s: %s\n"),
+                       argv0, path, reason);
+        goto cleanup;
+    }
+
+    /* In case the database being replaced was never snapshotted */
+    for (i = 0; keep_snapshots > 0 && !failed && i < ntargets; i++)
+        failed = osinfo_db_import_snapshot_take(&targets[i], FALSE) < 0;
+#endif /* !WIN32 */
+    for (i = 0; atomic && !failed && i < ntargets; i++)
+        failed = osinfo_db_import_target_begin(&targets[i], NULL) < 0;
+    if (!failed)
+        failed = osinfo_db_import_extract(&import, targets, ntargets,
+                                          archives, narchives) < 0;
+    /*
+     * Swap all the targets in only once all of them are staged, and
+     * swap the ones already done back if one of them cannot be.
+     */
+    for (i = 0; !failed && i < ntargets; i++)
+        failed = osinfo_db_import_target_commit(&targets[i],
+                                                import.sync != OSINFO_DB_IMPORT_SYNC_NONE) < 0;
+    if (failed) {
+        for (i = 0; i < ntargets; i++) {
+            osinfo_db_import_target_revert(&targets[i],
+                                           import.sync != OSINFO_DB_IMPORT_SYNC_NONE);
+            osinfo_db_import_target_abort(&targets[i]);
+        }
+#ifndef WIN32
+        /* Including the snapshot of the database kept in place */
+        for (i = 0; keep_snapshots > 0 && i < ntargets; i++)
+            osinfo_db_import_snapshot_expire(&targets[i], keep_snapshots);
+#endif /* !WIN32 */
+        goto cleanup;
+    }
+    for (i = 0; i < ntargets; i++)
+        osinfo_db_import_target_finish(&targets[i]);
+
+    for (i = 0; import.downloads && i < import.downloads->len; i++)
+        osinfo_db_import_archive_cache_add(g_ptr_array_index(import.downloads, i));
+
+    for (i = 0; cache && i < ntargets; i++)
+        osinfo_db_import_cache_save(metadata_url, targets[i].dir, cache);
+
+#ifndef WIN32
+    for (i = 0; keep_snapshots > 0 && i < ntargets; i++) {
+        if (osinfo_db_import_snapshot_take(&targets[i], TRUE) < 0 ||
+            osinfo_db_import_snapshot_expire(&targets[i], keep_snapshots) < 0)
+            goto cleanup;
+    }
+#endif /* !WIN32 */
+
+    if (skip_unchanged) {
+        g_print(_("%s: %d files written, %d unchanged, %d new\n"),
+                argv0, import.nwritten, import.nunchanged, import.nnew);
+    }
+    if (prune) {
+        g_print(_("%s: %u files and directories removed\n"),
+                argv0, import.npruned);
+    }
+
+    ret = EXIT_SUCCESS;
+ cleanup:
+    for (i = 0; i < ntargets; i++)
+        osinfo_db_import_target_clear(&targets[i]);
+    g_free(targets);
+    g_clear_pointer(&import.seen, g_hash_table_unref);
+    g_clear_object(&import.schemafile);
+#ifndef WIN32
+    osinfo_db_import_content_store_free(import.content);
+#endif /* !WIN32 */
+    g_clear_pointer(&import.downloads, g_ptr_array_unref);
+    osinfo_db_import_archive_cache_free(import.archives);
+    g_mutex_clear(&import.ratelock);
+    return ret;
 }
 
 
@@ -549,7 +4640,7 @@ osinfo-db-import - Import an osinfo database archive
 
 =head1 SYNOPSIS
 
-osinfo-db-import [OPTIONS...] [ARCHIVE-FILE]
+osinfo-db-import [OPTIONS...] [ARCHIVE-FILE...]
 
 =head1 DESCRIPTION
 
@@ -583,12 +4674,46 @@ If run by a privileged account (ie root), the B<local> database
 location will be used by default, otherwise the B<user> location
 will be used.
 
+The archive can be compressed with any of the formats supported by
+B<osinfo-db-export>, such as xz, zstd, gzip, bzip2 or lz4, or not
+compressed at all. The compression is detected from the content of
+the archive, whatever its name. Only compressions libarchive was
+built with are supported: an archive which would need an external
+program, such as B<zstd> or B<lz4>, is rejected rather than passed
+through it.
+
 When passing a non local ARCHIVE-FILE, only http:// and https://
 protocols are supported.
+Remote archives are extracted while they are being downloaded.
+If the connection is lost, the download is resumed where it
+stopped, retrying up to 3 times with an increasing delay. When the
+server provides an B<ETag> or B<Last-Modified> header, a copy of
+the data received is also kept in B<$XDG_CACHE_HOME/osinfo-db-tools>
+until the import completes, so that a later attempt to import the
+same URL only needs to download the remainder of the archive. The
+server is asked to send the whole archive again instead if it has
+changed in the meantime. Once imported, downloaded archives are kept
+in a cache, see B<--cache-size>, so importing the same URL again
+does not download it again unless it has changed.
 
 With no ARCHIVE-FILE, or when ARCHIVE-FILE is -, read standard
 input.
 
+Several ARCHIVE-FILEs can be given, in increasing order of
+priority, to layer them into a single database, for example a
+vendor archive, then a site archive, then local overrides. When
+more than one archive contains the same file, the one from the
+last archive wins, including the B<VERSION> and B<LICENSE> files.
+The archives are read starting from the last one, and a file is
+skipped when it was already provided by a later archive, so each
+file is written exactly once with its final content. As described
+in F<docs/database-layout.txt>, a zero-length file in a higher
+priority archive acts as a black-out: it replaces the file from
+the lower priority archives, and is installed as an empty file so
+that the entity is also masked in lower priority database
+locations. Several archives cannot be combined with B<--latest>,
+B<--nightly> or B<--checksum>.
+
 =head1 OPTIONS
 
 =over 8
@@ -611,13 +4736,29 @@ B<system> database location.
 =item B<--dir=PATH>
 
 Override the default behaviour to force installation into the
-custom directory B<PATH>.
+custom directory B<PATH>. This option can be repeated to install
+into several directories.
 
 =item B<--root=PATH>
 
 Prefix the installation location with the root directory
 given by C<PATH>. This is useful when wishing to install
-into a chroot environment or equivalent.
+into a chroot environment or equivalent. This option can be
+repeated to install into several root directories.
+
+When several B<--root> or B<--dir> options are given, the archive
+is installed into every combination of them. It is only read, or
+downloaded, and decompressed once, each file being written to all
+the locations in turn, so importing into many chroots costs little
+more than importing into one. With B<--latest>, the database is
+updated if any of the locations is older than the latest release.
+Without B<--atomic>, each location is updated in place, so if the
+import fails some locations may already have been updated. With
+B<--atomic>, every location is staged first and they are only
+swapped in once all of them are complete, one after the other. If
+one of the swaps fails, the locations already swapped are swapped
+back to their previous content. Locations which are the same
+directory, or where one is inside another, are rejected.
 
 =item B<--latest>
 
@@ -627,6 +4768,14 @@ The latest osinfo-db release is only downloaded and installed
 when it's newer than the one installed in the desired location.
 Note that this option is mutually exclusive with '--nightly'.
 
+When the release information publishes a B<sha256> digest or a
+B<size> for the archive, the import is always staged as with
+B<--atomic>, so that an archive which does not match can be thrown
+away, see B<--checksum>. The import then fails up front if the
+database location cannot be staged, because it is a mount point,
+such as a directory bind mounted into a container, or because its
+parent directory is not writable.
+
 =item B<--nightly>
 
 Downloads the nightly (unreleased) osinfo-db build from libosinfo's
@@ -634,7 +4783,285 @@ website and installs it in the desired location.
 Unlike with '--latest' with this option the nightly archive always
 downloaded and installed regardless of the version installed in the
 desired location. Note that this option is mutually exclusive with
-'--latest'.
+'--latest'. As with B<--latest>, a digest or size published for the
+archive implies staging the import as with B<--atomic>.
+
+=item B<--atomic>
+
+Extract the archive into a staging directory created next to the
+database location, and only swap it with the live directory once
+every entry has been written. Files already installed but not
+present in the archive are carried over using hard links, so the
+result is the same as without this option. Applications reading
+the database at the time of the import see either the previous
+content or the new one, never a mix of the two, and a failed or
+interrupted import leaves the previous content untouched.
+
+On Linux the swap is performed atomically with C<renameat2(2)>.
+Where that is not available, the live directory is briefly absent
+between two renames. The database location must not be a mount
+point, its parent must be writable, and the staging directory needs
+enough free space for the new files. The import fails before
+anything is extracted if the location cannot be staged. This option
+is not supported on Windows.
+
+=item B<--skip-unchanged>
+
+Compare each file in the archive with the one already installed,
+first by size and then by content, and only write it if they
+differ. This avoids needlessly replacing thousands of identical
+files, and waking up every process monitoring the database
+directory for changes, when importing an archive which is close
+to the installed version. The number of files written, left
+unchanged and newly created is reported at the end.
+
+=item B<--prune>
+
+Once the archive has been completely extracted, delete any file
+or directory in the database location which is not part of the
+archive, so that the installed database exactly mirrors it.
+Without this option, entities removed or renamed upstream are
+left behind. Each removed path is reported. Combine with
+B<--atomic> for the removals to become visible in the same step
+as the new files.
+
+=item B<--sync=MODE>
+
+Control how hard the import tries to ensure the database has been
+persisted to disk, in case of a crash or power loss, before it
+exits successfully. B<MODE> is one of:
+
+=over 4
+
+=item B<none>
+
+No explicit syncing is done, the data is written back by the
+kernel in its own time. This is the fastest, and is appropriate
+for throw-away environments such as CI containers or image
+builds which are synced as a whole later on. This is the default.
+
+=item B<batch>
+
+Once the whole archive has been extracted, flush the filesystem
+holding the database in a single operation, using C<syncfs(2)> on
+Linux and syncing each file in turn elsewhere. The cost is close
+to that of B<none>, while still guaranteeing the data is on disk
+when the command returns.
+
+=item B<full>
+
+Sync each file, and the directory containing it, as soon as it
+has been written. This is by far the slowest mode, as the import
+waits for the disk once or twice for every one of the thousands
+of files in the database, but guarantees that every file which
+was reported as installed is on disk.
+
+=back
+
+With B<batch> and B<full>, the directory holding the database
+location is also synced after an B<--atomic> swap. This option is
+not supported on Windows.
+
+=item B<--check-only>
+
+Together with B<--latest> or B<--nightly>, check whether an update
+is available for the desired location, without downloading or
+installing anything. See L</EXIT STATUS>.
+
+=item B<--metadata-url=URL>
+
+Together with B<--latest> or B<--nightly>, fetch the release
+information from B<URL> instead of libosinfo's website, for
+example from a local mirror. The file must have the same format
+as L<https://db.libosinfo.org/latest.json>, optionally with
+B<sha256> and B<size> members describing the archive.
+
+=item B<--checksum=SHA256>
+
+Verify that the SHA-256 digest of the archive is B<SHA256>, given
+in hexadecimal. With B<--latest> or B<--nightly>, the digest is
+also taken from the B<sha256> member of the release information
+when present, along with the archive B<size>, unless this option
+is given. The digest is computed while the archive is extracted,
+so the extraction is done into a staging directory as with
+B<--atomic>, and thrown away if the archive does not match, leaving
+the database location untouched. As with B<--atomic>, the database
+location must not be a mount point and its parent directory must be
+writable, otherwise the import fails before anything is extracted.
+On Windows, where B<--atomic> is not supported, a mismatch is only
+detected once the files have been written, and the import fails.
+
+=item B<--validate>
+
+Validate each XML file against the RNG schema while the archive is
+extracted, from the copy already held in memory, so that no
+separate pass over the installed files is needed. The schema is the
+B<schema/osinfo.rng> file from the archive, or if it has none, the
+one installed in the database location imported into or, failing
+that, in the locations it overrides. With several B<--root> or
+B<--dir> options, the first of them which has a schema is used.
+Files extracted before the schema are
+kept in memory until it is found. Zero-length black-out files are
+not validated. The extraction is done into a staging directory as
+with B<--atomic>, and thrown away if any file does not validate,
+leaving the database location untouched. On Windows, where
+B<--atomic> is not supported, invalid files are only detected once
+they have been written, and the import fails.
+
+=item B<--content-store=PATH>
+
+Keep the content of every installed file in the directory B<PATH>,
+named after its SHA-256 digest, and install hard links to it rather
+than separate copies. Files which are identical in several database
+locations, such as chroots or container images given with repeated
+B<--root> options, or across successive versions of the database,
+then share a single inode on disk and a single copy in the page
+cache, and are not written again. B<PATH> is created if needed and
+must be on the same filesystem as the database locations, otherwise
+plain copies are written. As the content is shared, the installed
+files are hard links to read-only objects, so they have mode 0444
+whatever the mode recorded in the archive, and must not be modified
+in place. With B<--sync=full>, objects are synced along with their
+directory in the store before they are linked. Content is
+never removed from the store: files in it with a single link are no
+longer used by any database and can be deleted. This option is not
+supported on Windows.
+
+=item B<--reflink>
+
+With B<--content-store>, install files as reflinks, copy-on-write
+clones sharing their blocks with the store, instead of hard links,
+on filesystems which support them, such as Btrfs or XFS. Each file
+keeps its own inode, so it can safely be modified, while the disk
+space is still shared. Elsewhere, plain copies are written.
+
+=item B<--cache-size=BYTES>
+
+Keep downloaded archives in B<$XDG_CACHE_HOME/osinfo-db-tools/archives>,
+named after their SHA-256 digest, until they take more than B<BYTES>
+bytes, after which the least recently used ones are removed. When
+the URL is imported again, for instance into another database
+location, the server is sent a conditional request with the
+B<ETag> or B<Last-Modified> header of the archive, and the cached
+copy is used if it has not changed. When the digest of the archive
+is known beforehand, from B<--checksum> or from the release
+information with B<--latest> or B<--nightly>, the cached copy is
+used without contacting the server at all. Archives are only cached
+once they have been imported successfully, and are read-only. As a
+cached archive is extracted, its content is checked against the
+digest it is named after, and on a mismatch the import fails and
+the archive is removed from the cache, so that the next run
+downloads it again. The import is therefore staged as with
+B<--atomic> whenever the cache is used, unless the database location
+cannot be staged, in which case the cache is left out. The default
+is 32 MiB, and 0 disables the cache.
+
+=item B<--shared-cache=PATH>
+
+Keep downloaded archives in the directory B<PATH> instead of the
+cache directory of the user, so that all the users on a host share
+them. B<PATH> is created group writable, so a directory owned by a
+group that all the users belong to should be used. As any of them
+could replace a cached archive, archives are always checked against
+their digest as they are extracted, see B<--cache-size>, and the
+import fails up front if the database location cannot be staged. A
+lock is taken on each URL while it is downloaded, so that several
+imports run at the same time download it only once, the others
+waiting for it to be in the cache. This option is not supported on
+Windows.
+
+=item B<--serve=PORT>
+
+Instead of importing anything, act as a mirror of the release
+information for the hosts of a site, serving it over HTTP on port
+B<PORT>, on all interfaces, until killed. With B<--latest> or
+B<--nightly>, the release information is fetched from
+L<https://db.libosinfo.org/latest.json> or
+L<https://db.libosinfo.org/nightly.json> respectively, or from
+B<--metadata-url>, and served under the same name, for example as
+B<http://HOST:PORT/latest.json>. The archive it points to is
+downloaded into the archive cache, see B<--cache-size> and
+B<--shared-cache>, and the served release information points to
+this server instead, along with the B<sha256> and B<size> of the
+archive so that the hosts can verify it. The release information
+is fetched again every 5 minutes in the background, with a
+conditional request, and the archive only when it has changed,
+however many hosts ask for them, so requests are never held up by
+upstream. If upstream cannot be reached, or the archive cannot be
+downloaded, the last release information fetched keeps being served,
+and both are tried again 5 minutes later. The hosts then
+run B<osinfo-db-import --latest --metadata-url
+http://HOST:PORT/latest.json>. With a B<PORT> of 0, a free port is
+picked, and printed on startup.
+
+=item B<--keep-snapshots=N>
+
+Keep the last B<N> imported versions of the database as snapshots,
+named after the content of their B<VERSION> file, in a hidden
+B<.NAME.snapshots> directory next to the database location B<NAME>.
+The database being replaced is snapshotted before the import if it
+was not already, and the new one once the import has succeeded,
+after which only the B<N> snapshots taken last are kept, whether the
+import succeeded or not. The snapshot of the installed version is
+always kept, even when it is older, e.g. after a B<--rollback>.
+Snapshots are made of hard links to the installed files,
+which are never modified in place by an import, so they take almost
+no disk space. Databases without a B<VERSION> file are not
+snapshotted. This option is not supported on Windows.
+
+=item B<--rollback>[=B<VERSION>]
+
+Instead of importing an archive, replace the database with its
+snapshot of version B<VERSION>, or without B<VERSION>, with the
+snapshot with the highest version older than the installed one.
+The snapshot is swapped into place in the same way as with
+B<--atomic>, using hard links so no file data is copied, and is
+kept so that it can be rolled back to again. The database being
+replaced is snapshotted first, so that the rollback can be undone
+with another B<--rollback>. This option is not supported on
+Windows.
+
+=item B<--io-priority=CLASS>
+
+Run the import in the I/O scheduling class B<CLASS>, so that it
+competes less with the disk I/O of other workloads, such as the
+guests of a busy hypervisor. With B<idle>, the import only gets the
+disk when no other process needs it, and may be starved for a long
+time. With B<best-effort>, it gets the lowest priority among the
+processes of the default class, so that it still makes progress.
+Depending on the I/O scheduler, the priority may only apply to
+reads and synchronous writes, such as those made with B<--sync>;
+B<--max-write-rate> also limits the data written to the page
+cache. This option is only supported on Linux.
+
+=item B<--max-write-rate=BYTES>
+
+Write at most B<BYTES> bytes per second on average, spreading the
+files of the archive over time rather than writing them in a single
+burst. As every file costs at least a block on disk, in addition to
+its inode, files smaller than 4096 bytes count as 4096 bytes. Up to
+one second worth of writes can go through at once. This applies
+across all the threads of B<--jobs>, and to B<--content-store>.
+
+=item B<--nice>
+
+Lower the CPU scheduling priority of the import, as with the
+C<nice(1)> command, so that decompressing and writing the archive,
+for example from B<cron>, does not slow down other workloads. On
+Linux, with I/O schedulers which support priorities, this also
+lowers the I/O priority, unless B<--io-priority> is given. This
+option is not supported on Windows.
+
+=item B<-j N>, B<--jobs=N>
+
+Write files using B<N> threads. The archive is still decompressed
+by a single thread, which hands each file over to the writer
+threads once it has been read into memory, while directories are
+always created before anything inside them. This mostly helps on
+network and overlay filesystems, where creating each file has a
+high latency. The default is 1, which writes each file directly
+as it is decompressed. If writing any file fails, the files not
+written yet are discarded and the import fails.
 
 =item B<-v>, B<--verbose>
 
@@ -648,6 +5075,24 @@ The exit status will be 0 if all files were installed
 successfully, or 1 if at least one file could not be
 installed.
 
+With B<--check-only>, the exit status will be 0 if the
+database is up to date, 100 if an update is available, or
+1 if the release information could not be retrieved.
+
+=head1 FILES
+
+After a successful update with B<--latest> or B<--nightly>,
+the B<ETag> and B<Last-Modified> headers of the release
+information are stored in B<$XDG_CACHE_HOME/osinfo-db-tools>,
+along with the version of the database they were imported into.
+Later runs against the same database location send them back
+in a conditional request, as long as that version is still the
+installed one, and stop straight away if the server replies
+that nothing has changed. After B<--rollback>, or after an older
+archive is imported by hand, they are ignored, so that the update
+is not missed. This makes running the update
+frequently, for example from cron on many hosts, very cheap.
+
 =head1 SEE ALSO
 
 C<osinfo-db-export(1)>, C<osinfo-db-path(1)>
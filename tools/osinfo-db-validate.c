@@ -27,6 +27,7 @@
 #include <glib/gi18n.h>
 
 #include "osinfo-db-util.h"
+#include "osinfo-db-xml.h"
 
 static gboolean verbose = FALSE;
 
@@ -74,10 +75,10 @@ static xmlDocPtr parse_file(GFile *file, GError **error)
     return doc;
 }
 
-static gboolean validate_file(xmlRelaxNGValidCtxtPtr rngValid, GFile *file, GFileInfo *info, GError **error);
+static gboolean validate_file(OsinfoDbSchema *rng, GFile *file, GFileInfo *info, GError **error);
 
 
-static gboolean validate_file_regular(xmlRelaxNGValidCtxtPtr rngValid,
+static gboolean validate_file_regular(OsinfoDbSchema *rng,
                                       GFile *file,
                                       GError **error)
 {
@@ -93,12 +94,8 @@ static gboolean validate_file_regular(xmlRelaxNGValidCtxtPtr rngValid,
     if (!(doc = parse_file(file, error)))
         goto cleanup;
 
-    if (xmlRelaxNGValidateDoc(rngValid, doc) != 0) {
-        g_set_error(error, OSINFO_DB_ERROR, 0,
-                    _("Unable to validate XML document '%s'"),
-                    uri);
+    if (!osinfo_db_schema_validate_doc(rng, doc, uri, error))
         goto cleanup;
-    }
 
     ret = TRUE;
 
@@ -108,7 +105,7 @@ static gboolean validate_file_regular(xmlRelaxNGValidCtxtPtr rngValid,
 }
 
 
-static gboolean validate_file_directory(xmlRelaxNGValidCtxtPtr rngValid, GFile *file, GError **error)
+static gboolean validate_file_directory(OsinfoDbSchema *rng, GFile *file, GError **error)
 {
     g_autoptr(GFileEnumerator) children = NULL;
     g_autoptr(GFileInfo) info = NULL;
@@ -119,7 +116,7 @@ static gboolean validate_file_directory(xmlRelaxNGValidCtxtPtr rngValid, GFile *
     while ((info = g_file_enumerator_next_file(children, NULL, error))) {
         g_autoptr(GFile) child = g_file_get_child(file, g_file_info_get_name(info));
         gboolean ret_validate;
-        ret_validate = validate_file(rngValid, child, info, error);
+        ret_validate = validate_file(rng, child, info, error);
 
         if (!ret_validate)
             return FALSE;
@@ -132,7 +129,7 @@ static gboolean validate_file_directory(xmlRelaxNGValidCtxtPtr rngValid, GFile *
 }
 
 
-static gboolean validate_file(xmlRelaxNGValidCtxtPtr rngValid, GFile *file, GFileInfo *info, GError **error)
+static gboolean validate_file(OsinfoDbSchema *rng, GFile *file, GFileInfo *info, GError **error)
 {
     g_autoptr(GFileInfo) thisinfo = NULL;
     g_autofree gchar *uri = g_file_get_uri(file);
@@ -149,10 +146,10 @@ static gboolean validate_file(xmlRelaxNGValidCtxtPtr rngValid, GFile *file, GFil
     }
 
     if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY) {
-        if (!validate_file_directory(rngValid, file, error))
+        if (!validate_file_directory(rng, file, error))
             return FALSE;
     } else if (g_file_info_get_file_type(info) == G_FILE_TYPE_REGULAR) {
-        if (!validate_file_regular(rngValid, file, error))
+        if (!validate_file_regular(rng, file, error))
             return FALSE;
     } else {
         g_set_error(error, OSINFO_DB_ERROR, 0,
@@ -167,53 +164,26 @@ static gboolean validate_file(xmlRelaxNGValidCtxtPtr rngValid, GFile *file, GFil
 
 static gboolean validate_files(GFile *schema, gsize nfiles, GFile **files, GError **error)
 {
-    xmlRelaxNGParserCtxtPtr rngParser = NULL;
-    xmlRelaxNGPtr rng = NULL;
-    xmlRelaxNGValidCtxtPtr rngValid = NULL;
+    OsinfoDbSchema *rng = NULL;
     gboolean ret = FALSE;
     gsize i;
-    g_autofree gchar *schemapath = NULL;
 
     xmlSetGenericErrorFunc(NULL, validate_generic_error_nop);
     /* Drop this typecast when >=libxml2-2.12.0 is required */
     xmlSetStructuredErrorFunc(NULL, (xmlStructuredErrorFunc) validate_structured_error_nop);
 
-    schemapath = g_file_get_path(schema);
-    rngParser = xmlRelaxNGNewParserCtxt(schemapath);
-    if (!rngParser) {
-        g_set_error(error, OSINFO_DB_ERROR, 0,
-                    _("Unable to create RNG parser for %s"),
-                    schemapath);
+    if (!(rng = osinfo_db_schema_new(schema, error)))
         goto cleanup;
-    }
-
-    rng = xmlRelaxNGParse(rngParser);
-    if (!rng) {
-        g_set_error(error, OSINFO_DB_ERROR, 0,
-                    _("Unable to parse RNG %s"),
-                    schemapath);
-        goto cleanup;
-    }
-
-    rngValid = xmlRelaxNGNewValidCtxt(rng);
-    if (!rngValid) {
-        g_set_error(error, OSINFO_DB_ERROR, 0,
-                    _("Unable to create RNG validation context %s"),
-                    schemapath);
-        goto cleanup;
-    }
 
     for (i = 0; i < nfiles; i++) {
-        if (!validate_file(rngValid, files[i], NULL, error))
+        if (!validate_file(rng, files[i], NULL, error))
             goto cleanup;
     }
 
     ret = TRUE;
 
  cleanup:
-    xmlRelaxNGFreeValidCtxt(rngValid);
-    xmlRelaxNGFreeParserCtxt(rngParser);
-    xmlRelaxNGFree(rng);
+    osinfo_db_schema_free(rng);
     return ret;
 }
 
@@ -0,0 +1,149 @@
+/*
+ * osinfo-db-xml: XML schema helper APIs
+ *
+ * Split out of osinfo-db-validate.c, Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <glib/gi18n.h>
+#include <libxml/parser.h>
+#include <libxml/relaxng.h>
+
+#include "osinfo-db-util.h"
+#include "osinfo-db-xml.h"
+
+/*
+ * A compiled RNG schema. The validation context is not thread safe,
+ * so a schema must only be used by one thread at a time.
+ */
+struct _OsinfoDbSchema {
+    xmlRelaxNGParserCtxtPtr parser;
+    xmlRelaxNGPtr rng;
+    xmlRelaxNGValidCtxtPtr valid;
+};
+
+static OsinfoDbSchema *osinfo_db_schema_compile(xmlRelaxNGParserCtxtPtr parser,
+                                                const gchar *name,
+                                                GError **err)
+{
+    OsinfoDbSchema *schema = g_new0(OsinfoDbSchema, 1);
+
+    schema->parser = parser;
+    if (!schema->parser) {
+        g_set_error(err, OSINFO_DB_ERROR, 0,
+                    _("Unable to create RNG parser for %s"),
+                    name);
+        goto error;
+    }
+
+    schema->rng = xmlRelaxNGParse(schema->parser);
+    if (!schema->rng) {
+        g_set_error(err, OSINFO_DB_ERROR, 0,
+                    _("Unable to parse RNG %s"),
+                    name);
+        goto error;
+    }
+
+    schema->valid = xmlRelaxNGNewValidCtxt(schema->rng);
+    if (!schema->valid) {
+        g_set_error(err, OSINFO_DB_ERROR, 0,
+                    _("Unable to create RNG validation context %s"),
+                    name);
+        goto error;
+    }
+
+    return schema;
+
+ error:
+    osinfo_db_schema_free(schema);
+    return NULL;
+}
+
+OsinfoDbSchema *osinfo_db_schema_new(GFile *file,
+                                     GError **err)
+{
+    g_autofree gchar *path = g_file_get_path(file);
+
+    return osinfo_db_schema_compile(xmlRelaxNGNewParserCtxt(path),
+                                    path, err);
+}
+
+/* Compile a schema held in memory, such as one read from an archive */
+OsinfoDbSchema *osinfo_db_schema_new_from_data(const gchar *name,
+                                               const gchar *data,
+                                               gsize length,
+                                               GError **err)
+{
+    return osinfo_db_schema_compile(xmlRelaxNGNewMemParserCtxt(data, length),
+                                    name, err);
+}
+
+void osinfo_db_schema_free(OsinfoDbSchema *schema)
+{
+    if (!schema)
+        return;
+
+    xmlRelaxNGFreeValidCtxt(schema->valid);
+    xmlRelaxNGFree(schema->rng);
+    xmlRelaxNGFreeParserCtxt(schema->parser);
+    g_free(schema);
+}
+
+gboolean osinfo_db_schema_validate_doc(OsinfoDbSchema *schema,
+                                       xmlDocPtr doc,
+                                       const gchar *name,
+                                       GError **err)
+{
+    if (xmlRelaxNGValidateDoc(schema->valid, doc) != 0) {
+        g_set_error(err, OSINFO_DB_ERROR, 0,
+                    _("Unable to validate XML document '%s'"),
+                    name);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Parse and validate an XML document held in memory */
+gboolean osinfo_db_schema_validate_data(OsinfoDbSchema *schema,
+                                        const gchar *name,
+                                        const gchar *data,
+                                        gsize length,
+                                        GError **err)
+{
+    xmlDocPtr doc;
+    gboolean ret;
+
+    if (!(doc = xmlReadMemory(data, length, name, NULL,
+                              XML_PARSE_NONET |
+                              XML_PARSE_NOWARNING))) {
+        g_set_error(err, OSINFO_DB_ERROR, 0,
+                    _("Unable to parse XML document '%s'"),
+                    name);
+        return FALSE;
+    }
+
+    ret = osinfo_db_schema_validate_doc(schema, doc, name, err);
+    xmlFreeDoc(doc);
+    return ret;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ */
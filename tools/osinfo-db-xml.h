@@ -0,0 +1,51 @@
+/*
+ * osinfo-db-xml: XML schema helper APIs
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef OSINFO_DB_XML_H__
+# define OSINFO_DB_XML_H__
+
+# include <gio/gio.h>
+# include <libxml/tree.h>
+
+typedef struct _OsinfoDbSchema OsinfoDbSchema;
+
+OsinfoDbSchema *osinfo_db_schema_new(GFile *file,
+                                     GError **err);
+OsinfoDbSchema *osinfo_db_schema_new_from_data(const gchar *name,
+                                               const gchar *data,
+                                               gsize length,
+                                               GError **err);
+void osinfo_db_schema_free(OsinfoDbSchema *schema);
+gboolean osinfo_db_schema_validate_doc(OsinfoDbSchema *schema,
+                                       xmlDocPtr doc,
+                                       const gchar *name,
+                                       GError **err);
+gboolean osinfo_db_schema_validate_data(OsinfoDbSchema *schema,
+                                        const gchar *name,
+                                        const gchar *data,
+                                        gsize length,
+                                        GError **err);
+
+#endif /* OSINFO_DB_XML_H__ */
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ */